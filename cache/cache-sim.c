@@ -2,35 +2,422 @@
 
 /* 
  * Direct mapped, set associative, and fully associative cache simulation.
+ * Multi-core private caches kept coherent with MESI or MOESI.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
 #include <pthread.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+#define MAX_STREAMS 64
+#define MAX_PHASES  256
+#define MAX_ACCESSES 0x7fffffffu /* Counts and indices of accesses are 32-bit */
+
+/* A pre-decoded access: its chunk address (the byte address shifted by
+   TRACE_CHUNK_BITS, the least line size) with the operation, a load, store
+   or instruction fetch, packed into the
+   low TRACE_OP_BITS. TRACE_LINE is the line of block_id_offset bits. */
+typedef uint64_t Trace;
+
+enum {LOAD, STORE, FETCH};
+
+#define TRACE_OP_BITS    2
+#define TRACE_CHUNK_BITS 4
+#define TRACE_OP(t)      ((t) & ((1 << TRACE_OP_BITS) - 1))
+#define TRACE_CHUNK(t)   ((uint64_t) (t) >> TRACE_OP_BITS)
+#define TRACE_LINE(t)    ((uint64_t) (t) >> (TRACE_OP_BITS + block_id_offset - TRACE_CHUNK_BITS))
+
+/* Arrays of accesses, stored in 4 bytes each while every one fits, which
+   is the case for all addresses below 2^34, and in 8 bytes otherwise.
+   Exactly one of compact and wide is set. The columns of the extended
+   format, the PC and the timestamp of every access, are NULL unless some
+   access has them, and so are the spans: the chunks after its first that
+   an access covers within its line. */
+typedef struct {
+	uint32_t *compact;
+	Trace    *wide;
+	uint64_t *pcs, *times;
+	uint8_t  *spans;
+} Traces;
+
+#define TRACE_COMPACT_MAX  UINT32_MAX
+
+static inline Trace
+traces_at(const Traces *t, unsigned i)
+{
+	return t->compact ? t->compact[i] : t->wide[i];
+}
+
+static inline void
+traces_put(Traces *t, unsigned i, Trace trace)
+{
+	if (t->compact)
+		t->compact[i] = trace;
+	else
+		t->wide[i] = trace;
+}
+
+/* Resizes to size accesses, converting the first amt to 8 bytes if wide */
+static void
+traces_resize(Traces *t, unsigned amt, unsigned size, bool wide)
+{
+	if (t->compact && wide) {
+		if (!(t->wide = malloc(size * sizeof(Trace))))
+			fprintf(stderr, "Out of memory.\n"), exit(1);
+		for (unsigned i = 0; i < amt; i++)
+			t->wide[i] = t->compact[i];
+		free(t->compact);
+		t->compact = NULL;
+	} else if (t->wide || wide) {
+		t->wide = realloc(t->wide, size * sizeof(Trace));
+	} else {
+		t->compact = realloc(t->compact, size * sizeof(uint32_t));
+	}
+
+	if ((!t->compact && !t->wide) ||
+	    (t->pcs && !(t->pcs = realloc(t->pcs, size * sizeof(uint64_t)))) ||
+	    (t->times && !(t->times = realloc(t->times, size * sizeof(uint64_t)))) ||
+	    (t->spans && !(t->spans = realloc(t->spans, size))))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+}
+
+/* Sets access i of a column of size accesses, creating it zeroed at the
+   first access that has the column */
+static void
+traces_column(uint64_t **column, unsigned size, unsigned i, bool has, uint64_t value)
+{
+	if (!*column && has && !(*column = calloc(size, sizeof(uint64_t))))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+	if (*column)
+		(*column)[i] = value;
+}
+
+/* Sets the span of access i, as traces_column */
+static void
+traces_span(Traces *t, unsigned size, unsigned i, uint8_t span)
+{
+	if (!t->spans && span && !(t->spans = calloc(size, 1)))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+	if (t->spans)
+		t->spans[i] = span;
+}
+
+static void
+traces_free(Traces *t)
+{
+	free(t->compact);
+	free(t->wide);
+	free(t->pcs);
+	free(t->times);
+	free(t->spans);
+}
+
+typedef struct {
+	unsigned hits, accesses;
+} TenantStats;
+
+/* A run of consecutive accesses to one line by one stream (see collapse_runs)
+ *
+ * first   index in g_traces of the first access of the run
+ * count   accesses in the run
+ * stores  RUN_STORE_SEEN if any is a store, and in the low bits the
+ *         number of stores before the first load
+ */
+#define RUN_STORE_SEEN      0x80
+#define RUN_LEADING(r)      ((r)->stores & ~RUN_STORE_SEEN)
+#define RUN_LEADING_MAX     0x7f
+
+typedef struct {
+	unsigned first;
+	uint16_t count;
+	uint8_t  stream;
+	uint8_t  stores;
+} Run;
+
+/* Set indexing other than the legacy set mask (see index_set)
+ *
+ * kind        modulo, XOR folding the tag into the index, modulo the
+ *             largest prime up to the sets, or skewed with a hash per way
+ * sets        sets indexed, any number of them
+ * log         bits of the index, rounded down
+ * reciprocal  2^128 / sets rounded up, for the modulo by multiplication
+ */
+enum indexing {INDEX_LEGACY, INDEX_MODULO, INDEX_XOR, INDEX_PRIME, INDEX_SKEW};
+
+typedef struct {
+	enum indexing kind;
+	uint64_t sets;
+	unsigned log;
+	__uint128_t reciprocal;
+} Index;
+
+/* Utility monitor for utility-based cache partitioning (UCP).
+ * A shadow tag directory per tenant, kept for every UMON_SAMPLE-th set
+ * in true LRU stack order, counts the hits at each stack position.
+ * That is the number of hits the tenant would get from each extra way.
+ *
+ * tags   [tenant][sampled set][stack position], MRU first, 0 when empty
+ * masks  way mask of each tenant, repartitioned every epoch accesses
+ * index  set indexing of the cache, or NULL for the set mask
+ */
+#define UMON_SAMPLE 32
+
+typedef struct {
+	unsigned ways, tenants, epoch, log;
+	uint64_t mask, sampled;
+	uint64_t *tags;
+	unsigned hits[MAX_STREAMS][16];
+	uint32_t masks[MAX_STREAMS];
+	const Index *index;
+} UtilityMonitor;
+
+/* A range of the sets of one cache, simulated on its own thread
+ *
+ * traces, streams  the accesses that map to the range (see sim_set_parallel)
+ * accesses         number of those that are not PART_PREFETCH_ONLY
+ * warm             number of those in the warm-up
+ * cache            all the sets, shared with the other partitions
+ */
+#define PART_PREFETCH_ONLY 0x80
+
+typedef struct {
+	Traces      traces;
+	uint8_t    *streams;
+	unsigned    amt, accesses, warm;
+	uint64_t    first_set, last_set;
+	struct set *cache;
+} Partition;
+
+/* Address translation (see sim_tlb_step)
+ *
+ * l1, l2      entries and ways of each TLB
+ * pwc         page-walk cache entries per page table level, at most 16
+ * page_shift  log2 of the page size backing the whole trace
+ */
+#define PAGE_SIZES 3
+
+typedef struct {
+	unsigned l1_entries, l1_ways, l2_entries, l2_ways, pwc;
+} TlbGeometry;
+
+typedef struct {
+	const TlbGeometry *geometry;
+	unsigned page_shift;
+	unsigned l2_hits, walks, walk_refs;
+} Tlb;
+
+/* Timing (see timing_access)
+ *
+ * hit, dram  latencies in cycles of a hit and of a miss to DRAM
+ * mshrs      misses outstanding at once, at most MAX_MSHRS
+ * now        cycle of the last issue
+ * end        cycle of the last fill
+ * latency    sum of the latencies of all accesses
+ * stalls     cycles stalled on busy MSHRs
+ * merged     accesses merged into the MSHR of their line
+ * lines      line and fill cycle of the busy MSHRs, busy from head on
+ * pending    busy MSHRs by line modulo TIMING_FILTER, to skip their search
+ */
+#define MAX_MSHRS     64
+#define TIMING_FILTER 256
+
+typedef struct {
+	unsigned hit, dram, mshrs;
+} TimingParams;
+
+typedef struct {
+	const TimingParams *params;
+	uint64_t now, end, start, latency, stalls, merged;
+	uint64_t lines[MAX_MSHRS], fills[MAX_MSHRS];
+	unsigned head, busy;
+	uint8_t pending[TIMING_FILTER];
+} Timing;
+
+/* Banks (see bank_access)
+ *
+ * banks      banks the lines are interleaved over, a line in bank line % banks
+ * width      accesses issued per cycle, at most MAX_ISSUE
+ * cycles     issue cycles
+ * conflicts  accesses put off to the next cycle by a busy bank
+ * issued     accesses issued in the current cycle, with their bank and line
+ */
+#define MAX_ISSUE 16
+
+typedef struct {
+	unsigned banks, width;
+} BankParams;
+
+typedef struct {
+	const BankParams *params;
+	uint64_t cycles, conflicts;
+	unsigned issued, bank[MAX_ISSUE];
+	uint64_t lines[MAX_ISSUE];
+} Banks;
+
+/* Sectored lines (see sim_sectored_step)
+ *
+ * line_log, sector_log  log2 of the line and sector sizes, in bytes
+ * line_misses           accesses missing their line, which is allocated
+ * sector_misses         accesses finding their line without their sector
+ * fills                 sectors filled
+ * used                  chunks first referenced in filled sectors
+ * writebacks            dirty sectors written back on eviction
+ */
+#define MIN_LINE_LOG 4
+#define MAX_LINE_LOG 8
+
+typedef struct {
+	unsigned line_log, sector_log;
+	uint64_t line_misses, sector_misses, fills, used, writebacks;
+} Sectors;
+
+/* PC-based replacement (see sim_policy_step)
+ *
+ * kind       SHiP or Hawkeye
+ * signature  PC signature that inserted every block (SHiP) or last
+ *            accessed it (Hawkeye)
+ * reused     whether every block hit since it was inserted (SHiP)
+ * counters   SHCT or Hawkeye predictor, saturating at POLICY_COUNTER_MAX
+ * stride     sets between the sampled sets, which alone train
+ * clock      accesses to every sampled set (Hawkeye)
+ * occupancy  OPTgen: lines that OPT keeps in every sampled set at each of
+ *            its last OPTGEN_WINDOW accesses (Hawkeye)
+ * sampler    last access time and signature of the lines recently accessed
+ *            in every sampled set (Hawkeye)
+ */
+#define POLICY_SIGNATURES  16384
+#define POLICY_COUNTER_MAX 7
+#define POLICY_SAMPLED     64
+#define SHIP_RRPV_MAX      3
+#define HAWKEYE_RRPV_MAX   7
+
+enum policy {POLICY_LRU, POLICY_SHIP, POLICY_HAWKEYE};
+
+typedef struct {
+	uint64_t line, time;
+	uint16_t signature;
+} SamplerEntry;
+
+typedef struct {
+	enum policy kind;
+	uint16_t *signature;
+	bool *reused;
+	uint8_t counters[POLICY_SIGNATURES];
+	uint64_t stride, *clock;
+	unsigned window;
+	uint8_t *occupancy;
+	SamplerEntry *sampler;
+} Policy;
 
+/* Sampled simulation (see sim_sampled)
+ *
+ * period, warm, unit  records between periodic units, records warming up
+ *                     before each unit, and records measured in it
+ * starts, amt         first measured record of every unit, ascending
+ * weights             what each unit stands for, in units, or NULL for 1
+ * hits, ...           sums of the hits and accesses of the units, their
+ *                     squares and products
+ */
 typedef struct {
+	unsigned period, warm, unit;
+	unsigned *starts, amt;
+	double *weights;
+	double hits, accesses, hits2, accesses2, products;
+} Sample;
+
+/* kb         cache size, 16KB when 0 (set associative only)
+ * tenants    per-stream hits and accesses, or NULL to only count totals
+ * way_masks  per-stream ways that misses may fill, or NULL for all ways
+ * ucp        repartitions way_masks at run time when not NULL
+ * part       simulate only this range of sets when not NULL
+ * set_index  precomputed set of every access (see set_index_of), or NULL
+ * runs       consume the runs of g_runs instead of the accesses of g_traces
+ * tlb        translate addresses instead, hits counting the L1 TLB
+ * sample     count only the sampled units when not NULL (see sim_sampled)
+ * series     hits at the end of every interval, or NULL (see sim_steps)
+ * seconds    wall time spent stepping
+ * timing     time the accesses when not NULL (see timing_access)
+ * banks      issue the accesses to banks when not NULL (see bank_access)
+ * index      set indexing when not NULL, instead of the set mask
+ * sectors    line and sector sizes and their counts (see sim_sectored_step)
+ * policy     PC-based replacement when not NULL (see sim_policy_step)
+ * clock      time of the accesses before the trace, those of a checkpoint
+ *            of a skewed cache resumed (see sim_skewed_do)
+ * step       advances the simulation over accesses [begin, end), keeping
+ *            the cache contents in state between calls
+ */
+typedef struct thread_info {
 	unsigned hits, accesses, kb;
 	union { unsigned ways; bool pseudo_lru;};
 	enum {OPTION_NONE, OPTION_WRITE_ON_MISS, OPTION_PREFETCH_ALWAYS, OPTION_PREFETCH_ON_MISS} options;
-	pthread_t thread;
+	TenantStats *tenants;
+	uint32_t *way_masks;
+	UtilityMonitor *ucp;
+	Partition *part;
+	const uint16_t *set_index;
+	bool runs;
+	Tlb *tlb;
+	Sample *sample;
+	unsigned *series;
+	double seconds;
+	Timing *timing;
+	Banks *banks;
+	const Index *index;
+	Sectors *sectors;
+	Policy *policy;
+	uint64_t clock;
+	void (*step)(struct thread_info *, unsigned begin, unsigned end);
+	void *state;
 } ThreadInfo;
 
-typedef struct {
-	enum {LOAD, STORE} op;
-	uint32_t addr;
-} Trace;
-
 struct set { 
 	uint64_t tags[16];
 	uint64_t lru[16];
 	bool valid[16]; 
 };
 
-Trace     g_traces[15000000];
+enum interleave {INTERLEAVE_ROUND_ROBIN, INTERLEAVE_PROPORTIONAL, INTERLEAVE_TIME};
+
+struct options {
+	enum {MODE_SWEEP, MODE_COHERENCE, MODE_SHARED, MODE_REUSE, MODE_L1} mode;
+	unsigned kb, ways, quantum, epoch, threads, fused;
+	int option;
+	enum interleave interleave;
+	bool moesi, directory, lockstep, set_index, runs;
+	uint32_t way_masks[MAX_STREAMS];
+	unsigned way_masks_amt;
+	TlbGeometry tlb;
+	TimingParams timing;
+	BankParams banks;
+	enum indexing indexing;
+	unsigned line_bytes, sector_bytes;
+	enum policy policy;
+	const char *checkpoint, *resume;
+	Sample sample;
+	unsigned phases;
+	const char *warmup;
+	enum format format;
+};
+
+Traces    g_traces;
 unsigned  g_traces_amt = 0;
+unsigned  g_crossings = 0;  /* Accesses split at the boundaries of the lines simulated */
+unsigned  g_warmup = 0;     /* Accesses that warm the caches up uncounted */
+unsigned  g_interval = 0;   /* Accesses per interval of the series, or 0 */
+uint8_t  *g_streams = NULL; /* Source trace of each access when interleaving */
+Run      *g_runs = NULL;
+unsigned  g_runs_amt = 0;
+unsigned  g_runs_warm = 0;  /* Runs in the warm-up, which they never cross */
 const uint64_t block_id_offset = 5;
 
 static const uint16_t
@@ -50,14 +437,62 @@ bitmask(unsigned range)
 	return ~(UINT32_MAX << mylog2(range));
 }
 
+static Index
+index_of(enum indexing kind, uint64_t sets)
+{
+	Index x = {kind, sets};
+
+	/* Prime modulo leaves the sets above the prime unused */
+	for (bool prime = false; kind == INDEX_PRIME && !prime && x.sets > 2; ) {
+		prime = true;
+		for (uint64_t d = 2; prime && d * d <= x.sets; d++)
+			prime = x.sets % d;
+		x.sets -= !prime;
+	}
+
+	x.log = mylog2(x.sets);
+	x.reciprocal = ~(__uint128_t) 0 / x.sets + 1;
+	return x;
+}
+
+/* n % sets, without dividing (Lemire et al., "Faster remainder by direct
+   computation") */
+static inline uint64_t
+index_mod(const Index *x, uint64_t n)
+{
+	const __uint128_t low = x->reciprocal * n;
+
+	return !(x->sets & (x->sets - 1)) ? n & (x->sets - 1) : (((low & UINT64_MAX) * x->sets >> 64) + (low >> 64) * x->sets) >> 64;
+}
+
+/* Set of a line, in the given way for skewed caches */
+static inline uint64_t
+index_set(const Index *x, uint64_t line, unsigned way)
+{
+	const uint64_t tag = line >> x->log;
+
+	switch (x->kind) {
+	case INDEX_XOR:
+		return index_mod(x, line ^ tag);
+	case INDEX_SKEW:
+		return index_mod(x, line ^ (((tag ^ way) * UINT64_C(0x9e3779b97f4a7c15)) >> 32));
+	default:
+		return index_mod(x, line);
+	}
+}
+
 static void
-sim_set_associative_insert_tag(struct set *s, uint64_t tag, int ways)
+sim_set_associative_insert_tag(struct set *s, uint64_t tag, int ways, uint32_t allowed)
 {
 	/* Find an empty block to insert the new tag.
 	   If we cannot find one, overwrite the block with
-	   the highest counter (least recently used). */
-	unsigned lru_way = 0, lru_largest = 0;
+	   the highest counter (least recently used).
+	   Only the ways in the allowed mask are candidates. */
+	unsigned lru_way = __builtin_ctz(allowed), lru_largest = 0;
 	for (int w = 0; w < ways; w++) {
+		if (!(allowed & (1u << w)))
+			continue;
+
 		if (s->lru[w] > lru_largest) {
 			lru_largest = s->lru[w];
 			lru_way = w;
@@ -80,291 +515,3047 @@ sim_set_associative_insert_tag(struct set *s, uint64_t tag, int ways)
 
 /* Returns HIT (true) or MISS (false) */
 static bool
-sim_set_associative_do(struct set *s, uint64_t tag, int ways, bool no_modify)
+sim_set_associative_do(struct set *s, uint64_t tag, int ways, bool no_modify,
+                       uint32_t allowed)
 {
 	bool hit = false;
 	/* Check all tags for a hit.
-	   Increment LRU counters for all tags. */
+	   Increment LRU counters for all tags.
+	   Ways never filled hold no tag, not even tag 0. */
 	for (int w = 0; w < ways; w++) {
 		s->lru[w]++;
 
-		if (s->tags[w] == tag) {
+		if (s->valid[w] && s->tags[w] == tag) {
 			hit = true;
 			s->lru[w] = 0;
 		}
 	}
 
 	if (!hit && !no_modify)
-		sim_set_associative_insert_tag(s, tag, ways);
+		sim_set_associative_insert_tag(s, tag, ways, allowed);
 
 	return hit;
 }
 
-static void *
-sim_set_associative(void *arg)
+/* Returns HIT (true) or MISS (false) for a skewed associative cache, where
+   the line may be in each way at the set of its hash for that way. Recency
+   is kept as the time of the last access, as the candidates are in
+   different sets, and the least recent of them is replaced. */
+static bool
+sim_skewed_do(struct set *cache, const Index *x, uint64_t line, int ways, bool no_modify,
+              uint32_t allowed, uint64_t now)
 {
-	/* This algorithm will not scale ad infinitum due to how
-	   the LRU tag is maintained. Although unlikely,
-	   certain memory-access patterns, and a long enough trace,
-	   may cause the counters overflow. */
-	struct set cache[1024] = {{{0}, {0}, {false}}};
+	const uint64_t tag = line << 1 | 1;
+	struct set *victim = NULL;
+	int victim_way = 0;
 
-	ThreadInfo *i = arg;
-	const uint64_t sets = (16 * 1024) / (32 * i->ways);
-	const uint64_t log = mylog2(sets);
-	const uint64_t mask = (i->ways == 1) ? bitmask(i->kb * 1024 / 32) : bitmask(sets);
-	i->accesses = g_traces_amt;
-	for (int ti = 0; ti < g_traces_amt; ti++) {
-		uint64_t set, addr, tag;
-		bool hit = false;
+	for (int w = 0; w < ways; w++) {
+		struct set *s = &cache[index_set(x, line, w)];
+
+		if (s->tags[w] == tag) {
+			s->lru[w] = now;
+			return true;
+		}
+		if ((allowed & (1u << w)) && (!victim || s->lru[w] < victim->lru[victim_way])) {
+			victim = s;
+			victim_way = w;
+		}
+	}
 
-		set = ((addr = g_traces[ti].addr) >> block_id_offset) & mask;
-		tag = addr >> (block_id_offset + log);
+	if (!no_modify && victim) {
+		victim->tags[victim_way] = tag;
+		victim->lru[victim_way] = now;
+		victim->valid[victim_way] = true;
+	}
 
-		if (i->ways == 1) { // Running in 1-way associative mode (aka direct mapping)
-			tag = addr >> 10;
+	return false;
+}
 
-			if (cache[set].tags[0] == tag)
-				i->hits++;
-			else 
-				cache[set].tags[0] = tag;
+/* Monitors sample the sets of the cache, as the index places lines in them */
+static void
+ucp_init(UtilityMonitor *u, unsigned ways, uint64_t sets, unsigned tenants, unsigned epoch,
+         const Index *index)
+{
+	if (index)
+		sets = index->sets;
+	*u = (UtilityMonitor) {ways, tenants, epoch, mylog2(sets), bitmask(sets),
+	                       (sets + UMON_SAMPLE - 1) / UMON_SAMPLE, .index = index};
+	if (!(u->tags = calloc(tenants * u->sampled * ways, sizeof(uint64_t))))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+}
 
-		} else {
-			i->hits += (hit = sim_set_associative_do(
-			            &cache[set], tag, i->ways,
-			            i->options == OPTION_WRITE_ON_MISS &&
-			            g_traces[ti].op == STORE));
-			if (i->options == OPTION_PREFETCH_ALWAYS ||
-			    (i->options == OPTION_PREFETCH_ON_MISS && !hit)) {
-				
-				set = ((addr + 32) >> block_id_offset) & mask;
-				tag = (addr + 32) >> (block_id_offset + mylog2(sets));
-				sim_set_associative_do(&cache[set], tag, i->ways, false);
+/* Lookahead allocation: starting from one way each, repeatedly give the
+   tenant with the highest marginal utility per way the ways that
+   achieve it. Partitions are laid out as contiguous masks. */
+static void
+ucp_repartition(UtilityMonitor *u)
+{
+	unsigned alloc[MAX_STREAMS], balance = u->ways - u->tenants, first = 0;
+
+	for (unsigned t = 0; t < u->tenants; t++)
+		alloc[t] = 1;
+
+	while (balance) {
+		unsigned winner = 0, winner_ways = 1;
+		double winner_mu = -1;
+
+		for (unsigned t = 0; t < u->tenants; t++) {
+			unsigned gain = 0;
+
+			for (unsigned k = 1; k <= balance && alloc[t] + k <= u->ways; k++) {
+				gain += u->hits[t][alloc[t] + k - 1];
+				if ((double) gain / k > winner_mu) {
+					winner_mu = (double) gain / k;
+					winner = t;
+					winner_ways = k;
+				}
 			}
 		}
-		
+
+		alloc[winner] += winner_ways;
+		balance -= winner_ways;
 	}
 
-	return NULL;
+	for (unsigned t = 0; t < u->tenants; t++) {
+		u->masks[t] = ((1u << alloc[t]) - 1) << first;
+		first += alloc[t];
+
+		/* Age the counters so that old phases fade out */
+		for (unsigned w = 0; w < u->ways; w++)
+			u->hits[t][w] /= 2;
+	}
 }
 
-static void *
-sim_fully_associative(void *arg)
+static void
+ucp_access(UtilityMonitor *u, unsigned tenant, uint64_t line, unsigned ti)
 {
-	/* We are running this with 32 bytes line size
-	   and 16 KB total cache size.
-	   512 blocks * 32 bytes = 16KB cache */
-	struct block {
-		uint64_t tag;
-		uint64_t lru;
-	} cache[512] = {{0}, {0}};
+	uint64_t set = u->index ? index_set(u->index, line, 0) : line & u->mask;
+	uint64_t tag = (u->index ? line : line >> u->log) << 1 | 1;
 
-	ThreadInfo *i = arg;
+	if (set % UMON_SAMPLE == 0) {
+		uint64_t *stack = &u->tags[((uint64_t) tenant * u->sampled + set / UMON_SAMPLE) * u->ways];
+		unsigned pos = 0;
 
-	i->accesses = g_traces_amt;
-	for (int ti = 0; ti < g_traces_amt; ti++) {
-		uint64_t addr, tag;
-		bool hit = false;
+		while (pos < u->ways - 1 && stack[pos] != tag)
+			pos++;
 
-		tag = (addr = g_traces[ti].addr) >> block_id_offset;
+		if (stack[pos] == tag)
+			u->hits[tenant][pos]++;
 
-		/* Search for tag in cache */
-		for (int b = 0; b < 512; b += 8) {
-			#define SIMFA_UNROLL1(N)                      \
-			cache[((b) + (N))].lru++;                    \
-			if (!hit && cache[((b) + (N))].tag == tag) { \
-				hit = true;                      \
-				cache[((b) + (N))].lru = 0;          \
-			}
+		/* Move to MRU, dropping the LRU entry on a miss */
+		memmove(&stack[1], &stack[0], pos * sizeof(uint64_t));
+		stack[0] = tag;
+	}
 
-			/* We are sacrificing everything here
-			   for the sole purpose of speed... */
-			SIMFA_UNROLL1(0);SIMFA_UNROLL1(1);
-			SIMFA_UNROLL1(2);SIMFA_UNROLL1(3);
-			SIMFA_UNROLL1(4);SIMFA_UNROLL1(5);
-			SIMFA_UNROLL1(6);SIMFA_UNROLL1(7);
-		}
+	if ((ti + 1) % u->epoch == 0)
+		ucp_repartition(u);
+}
 
-		if (hit) {
-			i->hits++;
-		} else {
-			bool hasempty = false;
-			unsigned lru_block = 0, lru_largest = 0;
-			for (int w = 0; w < 512; w += 8) {
-				#define SIMFA_UNROLL2(N) \
-				if (cache[w + N].lru > lru_largest) { \
-					lru_largest = cache[w + N].lru; \
-					lru_block = w + N; \
-				} \
-				if (cache[w + N].tag == 0) { \
-					cache[w + N].tag = tag; \
-					cache[w + N].lru = 0; \
-					hasempty = true; \
-					break; \
-				}
+/*
+ * Timing.
+ *
+ * Accesses issue in order, one per cycle, into a non-blocking cache. Hits
+ * take the hit latency. A miss takes an MSHR for the hit and DRAM latencies
+ * and the core goes on issuing. The core stalls only when a miss finds
+ * every MSHR busy, until the first one frees up. Any access to a line that
+ * is still being filled merges into its MSHR, whether the functional cache
+ * called it a hit or a miss, and waits for the fill. Prefetches are not
+ * timed. AMAT is the mean latency, and the cycles run from the first issue
+ * to the last fill.
+ */
+static void
+timing_access(Timing *t, uint64_t line, bool hit)
+{
+	const TimingParams *p = t->params;
+	uint64_t latency = p->hit;
 
-				SIMFA_UNROLL2(0);SIMFA_UNROLL2(1);
-				SIMFA_UNROLL2(2);SIMFA_UNROLL2(3);
-				SIMFA_UNROLL2(4);SIMFA_UNROLL2(5);
-				SIMFA_UNROLL2(6);SIMFA_UNROLL2(7);
-			}
+	/* Every miss takes as long, so MSHRs fill in the order they are taken */
+	t->now++;
+	while (t->busy && t->fills[t->head] <= t->now) {
+		t->pending[t->lines[t->head] % TIMING_FILTER]--;
+		t->head = (t->head + 1) % MAX_MSHRS;
+		t->busy--;
+	}
 
-			if (!hasempty) {
-				/* Failed to place tag in an empty block;
-				   Overwrite the least recently used block. */
-				cache[lru_block].tag = tag;
-				cache[lru_block].lru = 0;
-			}
+	for (unsigned k = 0; t->pending[line % TIMING_FILTER] && k < t->busy; k++) {
+		const unsigned m = (t->head + k) % MAX_MSHRS;
+
+		if (t->lines[m] == line) {
+			t->merged++;
+			t->latency += t->fills[m] - t->now > latency ? t->fills[m] - t->now : latency;
+			return;
 		}
+	}
 
+	if (!hit) {
+		if (t->busy == p->mshrs) {
+			t->stalls += t->fills[t->head] - t->now;
+			t->now = t->fills[t->head];
+			t->pending[t->lines[t->head] % TIMING_FILTER]--;
+			t->head = (t->head + 1) % MAX_MSHRS;
+			t->busy--;
+		}
+		latency = p->hit + p->dram;
+		t->end = t->now + latency;
+		t->lines[(t->head + t->busy) % MAX_MSHRS] = line;
+		t->fills[(t->head + t->busy++) % MAX_MSHRS] = t->end;
+		t->pending[line % TIMING_FILTER]++;
 	}
-	
-	return NULL;
+
+	t->latency += latency;
 }
 
-static void *
-sim_fully_associative_pseudo(void *arg)
+/* Restarts the counts, for the end of the warm-up */
+static void
+timing_reset(Timing *t)
 {
-	/* We are running this with 32 bytes line size
-	   and 16 KB total cache size.
-	   512 blocks * 32 bytes = 16KB cache
+	t->latency = t->stalls = t->merged = 0;
+	t->start = t->now;
+}
 
-	   Combining the LRU bits and the cache will allow us
-	   to easily translate between a cache block, and it's
-	   corresponding LRU bit.
+/* Cycles from the first issue to the last fill */
+static uint64_t
+timing_cycles(const Timing *t)
+{
+	return (t->end > t->now ? t->end : t->now + t->params->hit) - t->start;
+}
 
-	   It is possible that this approach worsens spatial locality.
+/*
+ * Banks.
+ *
+ * The lines are interleaved over banks by their low address bits, each bank
+ * serving one line per cycle. Accesses issue in trace order, up to the issue
+ * width per cycle; an access to a bank already serving another line this
+ * cycle conflicts and starts the next cycle, while accesses to the same line
+ * share its read. Hits and misses issue alike, so the banks of every cache
+ * with the same lines see the same conflicts (see bank_trace).
+ */
+static void
+bank_access(Banks *b, uint64_t line)
+{
+	const unsigned bank = line % b->params->banks;
+	bool conflict = false;
 
-	   511 table bytes  indexes 0 to 510     for LRU calculation
-	   512 cache bytes  indexes 511 to 1023 for holding cached tags */
-	uint64_t lru_cache[1024] = {0};
+	for (unsigned k = 0; b->issued < b->params->width && k < b->issued; k++)
+		conflict |= b->bank[k] == bank && b->lines[k] != line;
 
-	ThreadInfo *i = arg;
-	i->accesses = g_traces_amt;
-	for (int ti = 0; ti < g_traces_amt; ti++) {
-		uint64_t addr, tag;
-		bool hit = false;
+	if (conflict || !b->issued || b->issued == b->params->width) {
+		b->conflicts += conflict;
+		b->cycles++;
+		b->issued = 0;
+	}
+	b->bank[b->issued] = bank;
+	b->lines[b->issued++] = line;
+}
+
+/* Banks the lines of the trace after the warm-up, once for all the caches
+   of the sweep */
+static void
+bank_trace(Banks *b)
+{
+	for (unsigned ti = g_warmup; ti < g_traces_amt; ti++)
+		bank_access(b, TRACE_LINE(traces_at(&g_traces, ti)));
+}
 
-		tag = (addr = g_traces[ti].addr) >> block_id_offset;
+/* Number of records, accesses or runs, the configuration steps over */
+static unsigned
+sim_records(const ThreadInfo *i)
+{
+	return i->part ? i->part->amt : i->runs ? g_runs_amt : g_traces_amt;
+}
 
-		/* If we find a hit, update the path to the least recently used tag. */
-		for (int block = 511; block < 1023; block++) {
-			if (lru_cache[block] == tag) {
-				hit = (i->hits++ - i->hits);
+/* Number of those records in the warm-up */
+static unsigned
+sim_warmup(const ThreadInfo *i)
+{
+	return i->part ? i->part->warm : i->runs ? g_runs_warm : g_warmup;
+}
 
-				do
-					lru_cache[(block - 1) / 2] = (block % 2) ? 0 : 1;
-				while ((block = (block - 1) / 2));
-				break;
-			}
-		}
+/* First record at or after the access, outside of partitions */
+static unsigned
+sim_record_of(void *arg, uint64_t access)
+{
+	const ThreadInfo *i = arg;
+	unsigned low = 0, high = g_runs_amt;
 
-		/* Start at first LRU bit, 0.
-		   Follow the 'coldest' path to find the least recently used tag.
-		   tmp will be set the index of the least recently used tag. */
-		int tmp = 0;
-		if(!hit) {
-			for (tmp; tmp < 511; tmp = 2 * tmp + (!(lru_cache[tmp] = !lru_cache[tmp]) ? 1 : 2));
-			lru_cache[tmp] = tag;
-		}
+	if (access >= g_traces_amt)
+		return sim_records(i);
+	if (!i->runs)
+		return access;
+
+	while (low < high) {
+		const unsigned mid = low + (high - low) / 2;
+
+		if (g_runs[mid].first < access)
+			low = mid + 1;
+		else
+			high = mid;
 	}
-	return NULL;
+
+	return low;
 }
 
-int
-main(int argc, char *argv[])
+static void
+sim_step(void *arg, unsigned begin, unsigned end)
 {
-	FILE *input, *output;
-	uint32_t addr;
-	char behavior;
+	ThreadInfo *i = arg;
 
-	if (argc != 3)
-		fprintf(stderr, "Usage: predictors input.txt output.txt\n"), exit(1);
+	i->step(i, begin, end);
+}
 
-	if (!(input = fopen(argv[1], "r")) || !(output = fopen(argv[2], "w")))
-		fprintf(stderr, "Failed to open files.\n"), exit(1);
+/* Drops the counts of the configuration at the end of its warm-up */
+static void
+sim_reset(void *arg)
+{
+	ThreadInfo *i = arg;
 
-	/* Read trace into g_traces */
-	while(fscanf(input, "%c %x\n", &behavior, &addr) != EOF)
-		g_traces[g_traces_amt++] = (Trace) {behavior == 'L' ? LOAD : STORE, addr};
-	fclose(input);
-	
-	/**
-	 * threads[0] - direct
-	 * threads[1] - set associative
-	 * threads[2] - fully associative
-	 */
-	ThreadInfo threads[6][4];
-
-	/* Run fully-associative caches asynchronously */
-	threads[2][0] = (ThreadInfo) {0, 0};
-	(void) pthread_create(&threads[2][0].thread, NULL,
-	                      sim_fully_associative, (void *) &threads[2][0]);
-	threads[2][1] = (ThreadInfo) {0, 0};
-	(void) pthread_create(&threads[2][1].thread, NULL,
-	                      sim_fully_associative_pseudo, (void *) &threads[2][1]);
-
-	/* Simulate direct cache */
-	for (int kb = 1; kb <= 32; kb *= 2) {
-		if (kb == 2 || kb == 8)
-			continue;
+	i->hits = i->accesses = 0;
+	if (i->tenants)
+		memset(i->tenants, 0, MAX_STREAMS * sizeof(TenantStats));
+	if (i->tlb)
+		i->tlb->l2_hits = i->tlb->walks = i->tlb->walk_refs = 0;
+	if (i->timing)
+		timing_reset(i->timing);
+	if (i->banks)
+		*i->banks = (Banks) {i->banks->params};
+	if (i->sectors)
+		*i->sectors = (Sectors) {i->sectors->line_log, i->sectors->sector_log};
+}
 
-		ThreadInfo info = {0, 0, .kb = kb, .ways = 1};
-		sim_set_associative(&info);
-		fprintf(output, "%d,%d; ", info.hits, info.accesses);
-	}
-	fprintf(output, "\n");
-	
-	
-	/* Set associative */
-	for (int asc = 2; asc <= 16; asc *= 2) {
-		ThreadInfo info = {0, 0, .ways = asc};
-		sim_set_associative(&info);
-		fprintf(output, "%d,%d; ", info.hits, info.accesses);
-	}
-	fprintf(output, "\n");
+static unsigned
+sim_hits(void *arg)
+{
+	return ((ThreadInfo *) arg)->hits;
+}
 
-	/* Join the fully-associative threads */
-	(void) pthread_join(threads[2][0].thread, NULL);
-	(void) pthread_join(threads[2][1].thread, NULL);
-	fprintf(output, "%d,%d;\n", threads[2][0].hits, threads[2][0].accesses);
-	fprintf(output, "%d,%d;\n", threads[2][1].hits, threads[2][1].accesses);
+static uint64_t
+sim_access_of(void *arg, unsigned record)
+{
+	return ((ThreadInfo *) arg)->runs ? g_runs[record].first : record;
+}
 
-	/* Set associative with Write on Miss */
-	for (int asc = 2, i = 0; asc <= 16; asc *= 2, i++) {
-		threads[3][i] = (ThreadInfo) {0, 0, .kb = 16, .ways = asc, .options = OPTION_WRITE_ON_MISS};
-		(void) pthread_create(&threads[3][i].thread, NULL,
-	                      sim_set_associative, (void *) &threads[3][i]);
-	}
+/* Steps the configuration over records [begin, end) (see steps_run), its
+   series holding hits */
+static void
+sim_steps(ThreadInfo *i, unsigned begin, unsigned end)
+{
+	steps_run(&(Steps) {i, sim_step, sim_reset, sim_hits, sim_access_of, sim_record_of,
+	                    sim_warmup(i), g_warmup, g_interval, i->series, &i->seconds},
+	          begin, end);
+}
 
-	/* Set associative with always prefetch */
-	for (int asc = 2, i = 0; asc <= 16; asc *= 2, i++) {
-		threads[4][i] = (ThreadInfo) {0, 0, .ways = asc, .options = OPTION_PREFETCH_ALWAYS};
-		(void) pthread_create(&threads[4][i].thread, NULL,
-	                      sim_set_associative, (void *) &threads[4][i]);
-	}
+/* Precomputed set indices of every access, one array per geometry */
+#define SET_INDEX_MAX 16
 
+struct set_index {
+	uint64_t mask;
+	uint16_t *index;
+} g_set_index[SET_INDEX_MAX];
+unsigned g_set_index_amt = 0;
 
-	for (int i = 0; i < 4; i++) {
-		(void) pthread_join(threads[3][i].thread, NULL);
-		fprintf(output, "%d,%d; ", threads[3][i].hits, threads[3][i].accesses);
-	}
-	fprintf(output, "\n");
+static uint64_t
+sim_set_associative_mask(const ThreadInfo *i)
+{
+	const uint64_t sets = ((i->kb ? i->kb : 16) * 1024) / (32 * i->ways);
 
-	for (int i = 0; i < 4; i++) {
-		(void) pthread_join(threads[4][i].thread, NULL);
-		fprintf(output, "%d,%d; ", threads[4][i].hits, threads[4][i].accesses);
-	}
-	fprintf(output, "\n");
+	return (i->ways == 1) ? bitmask(i->kb * 1024 / 32) : bitmask(sets);
+}
 
-	/* Set associative with prefetch on miss */
-	for (int asc = 2; asc <= 16; asc *= 2) {
-		ThreadInfo info = {0, 0, .ways = asc, .options = OPTION_PREFETCH_ON_MISS};
-		sim_set_associative(&info);
-		fprintf(output, "%d,%d; ", info.hits, info.accesses);
-	}
-	fprintf(output, "\n");
+/* Returns the set of every access in g_traces for a cache with the given
+   set mask, computing it the first time. Not thread safe, so call it while
+   setting up the jobs. NULL when out of room or the sets do not fit. */
+static const uint16_t *
+set_index_of(uint64_t mask)
+{
+	struct set_index *si;
+
+	for (unsigned g = 0; g < g_set_index_amt; g++)
+		if (g_set_index[g].mask == mask)
+			return g_set_index[g].index;
+
+	if (g_set_index_amt == SET_INDEX_MAX || mask > UINT16_MAX)
+		return NULL;
+
+	si = &g_set_index[g_set_index_amt++];
+	if (!(si->index = malloc(g_traces_amt * sizeof(uint16_t))))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+	si->mask = mask;
+
+	for (unsigned ti = 0; ti < g_traces_amt; ti++)
+		si->index[ti] = TRACE_LINE(traces_at(&g_traces, ti)) & mask;
+
+	return si->index;
+}
+
+/* Simulates one access and its prefetch. Returns HIT (true) or MISS (false) */
+static inline bool
+sim_set_associative_access(ThreadInfo *i, struct set *cache, uint64_t mask, uint64_t log,
+                           uint64_t line, uint64_t set, bool store, uint32_t allowed)
+{
+	Partition *part = i->part;
+	uint64_t tag = line >> log;
+	bool hit = false;
+
+	if (i->ways == 1) { // Running in 1-way associative mode (aka direct mapping)
+		tag = line >> (10 - block_id_offset);
+
+		if (cache[set].valid[0] && cache[set].tags[0] == tag)
+			hit = true;
+		else {
+			cache[set].tags[0] = tag;
+			cache[set].valid[0] = true;
+		}
+
+	} else {
+		hit = sim_set_associative_do(
+		            &cache[set], tag, i->ways,
+		            i->options == OPTION_WRITE_ON_MISS && store, allowed);
+		if (i->options == OPTION_PREFETCH_ALWAYS ||
+		    (i->options == OPTION_PREFETCH_ON_MISS && !hit)) {
+			
+			set = (line + 1) & mask;
+			tag = (line + 1) >> log;
+			if (!part || (set >= part->first_set && set < part->last_set))
+				sim_set_associative_do(&cache[set], tag, i->ways, false, allowed);
+		}
+	}
+
+	return hit;
+}
+
+/* Simulates one access and its prefetch with indexing other than the set
+   mask, where tags are whole lines. Returns HIT (true) or MISS (false) */
+static inline bool
+sim_indexed_access(ThreadInfo *i, struct set *cache, uint64_t line, uint64_t set, bool store,
+                   uint32_t allowed, uint64_t now)
+{
+	const Index *x = i->index;
+	const bool no_modify = i->options == OPTION_WRITE_ON_MISS && store;
+	bool hit;
+
+	if (x->kind == INDEX_SKEW)
+		hit = sim_skewed_do(cache, x, line, i->ways, no_modify, allowed, now);
+	else
+		hit = sim_set_associative_do(&cache[set], line << 1 | 1, i->ways, no_modify, allowed);
+
+	if (i->options == OPTION_PREFETCH_ALWAYS || (i->options == OPTION_PREFETCH_ON_MISS && !hit)) {
+		if (x->kind == INDEX_SKEW)
+			sim_skewed_do(cache, x, line + 1, i->ways, false, allowed, now);
+		else
+			sim_set_associative_do(&cache[index_set(x, line + 1, 0)], (line + 1) << 1 | 1,
+			                       i->ways, false, allowed);
+	}
+
+	return hit;
+}
+
+/* Simulates n more hits on a tag that is in the set, as n calls
+   to sim_set_associative_do() would. */
+static void
+sim_set_associative_repeat(struct set *s, uint64_t tag, int ways, unsigned n)
+{
+	for (int w = 0; w < ways; w++) {
+		s->lru[w] += n;
+
+		if (s->valid[w] && s->tags[w] == tag)
+			s->lru[w] = 0;
+	}
+}
+
+static struct set *
+sim_set_associative_cache(ThreadInfo *i, uint64_t mask)
+{
+	struct set *cache = i->state;
+
+	if (!cache && !(cache = i->state = i->part ? i->part->cache :
+	                calloc(i->index ? i->index->sets : mask + 1, sizeof(struct set))))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	return cache;
+}
+
+static void
+sim_set_associative_runs(ThreadInfo *i, unsigned begin, unsigned end)
+{
+	const uint64_t sets = ((i->kb ? i->kb : 16) * 1024) / (32 * i->ways);
+	const uint64_t log = mylog2(sets);
+	const uint64_t mask = sim_set_associative_mask(i);
+	const bool prefetch = i->ways > 1 && (i->options == OPTION_PREFETCH_ALWAYS ||
+	                                      i->options == OPTION_PREFETCH_ON_MISS);
+	struct set *cache = sim_set_associative_cache(i, mask);
+
+	for (unsigned ri = begin; ri < end; ri++) {
+		const Run *r = &g_runs[ri];
+		const uint64_t line = TRACE_LINE(traces_at(&g_traces, r->first)), set = line & mask;
+		const unsigned leading = RUN_LEADING(r);
+		uint32_t allowed = i->way_masks ? i->way_masks[r->stream] : UINT32_MAX;
+		unsigned hits = 0, single = 1;
+
+		/* Only the first access may miss, except that stores keep missing
+		   with write on miss until a load brings the line in. A prefetch
+		   into the same set interleaves with the demand accesses. */
+		if (i->options == OPTION_WRITE_ON_MISS)
+			single = leading < r->count ? leading + 1 : r->count;
+		if (prefetch && ((line + 1) & mask) == set)
+			single = r->count;
+
+		for (unsigned a = 0; a < single; a++)
+			hits += sim_set_associative_access(i, cache, mask, log, line, set,
+			                                   a < leading, allowed);
+
+		if (single < r->count && i->ways > 1) {
+			sim_set_associative_repeat(&cache[set], line >> log, i->ways, r->count - single);
+			if (i->options == OPTION_PREFETCH_ALWAYS)
+				sim_set_associative_repeat(&cache[(line + 1) & mask], (line + 1) >> log,
+				                           i->ways, r->count - single);
+		}
+		hits += r->count - single;
+
+		i->hits += hits;
+		i->accesses += r->count;
+		if (i->tenants) {
+			i->tenants[r->stream].hits += hits;
+			i->tenants[r->stream].accesses += r->count;
+		}
+	}
+}
+
+static void
+sim_set_associative_step(ThreadInfo *i, unsigned begin, unsigned end)
+{
+	/* This algorithm will not scale ad infinitum due to how
+	   the LRU tag is maintained. Although unlikely,
+	   certain memory-access patterns, and a long enough trace,
+	   may cause the counters overflow. */
+	Partition *part = i->part;
+	const uint64_t sets = ((i->kb ? i->kb : 16) * 1024) / (32 * i->ways);
+	const uint64_t log = mylog2(sets);
+	const uint64_t mask = sim_set_associative_mask(i);
+	const Traces *traces = part ? &part->traces : &g_traces;
+	const uint8_t *streams = part ? part->streams : g_streams;
+	struct set *cache;
+
+	if (i->runs) {
+		sim_set_associative_runs(i, begin, end);
+		return;
+	}
+
+	cache = sim_set_associative_cache(i, mask);
+	i->accesses += end - begin;
+	for (unsigned ti = begin; ti < end; ti++) {
+		uint64_t set, line;
+		uint32_t allowed = UINT32_MAX;
+		bool hit;
+
+		line = TRACE_LINE(traces_at(traces, ti));
+		set = i->set_index ? i->set_index[ti] : i->index ? index_set(i->index, line, 0) : line & mask;
+
+		if (i->way_masks)
+			allowed = i->way_masks[streams[ti] & ~PART_PREFETCH_ONLY];
+
+		if (part && (streams[ti] & PART_PREFETCH_ONLY)) {
+			/* The access belongs to another partition, only
+			   its prefetch of the next line lands here */
+			sim_set_associative_do(&cache[(line + 1) & mask], (line + 1) >> log,
+			                       i->ways, false, allowed);
+			i->accesses--;
+			continue;
+		}
+
+		if (i->index)
+			hit = sim_indexed_access(i, cache, line, set, TRACE_OP(traces_at(traces, ti)) == STORE,
+			                         allowed, i->clock + ti + 1);
+		else
+			hit = sim_set_associative_access(i, cache, mask, log, line, set,
+			                                 TRACE_OP(traces_at(traces, ti)) == STORE, allowed);
+		i->hits += hit;
+
+		if (i->ucp)
+			ucp_access(i->ucp, streams[ti], line, ti);
+
+		if (i->timing)
+			timing_access(i->timing, line, hit);
+
+		if (i->banks)
+			bank_access(i->banks, line);
+
+		if (i->tenants) {
+			i->tenants[streams[ti]].hits += hit;
+			i->tenants[streams[ti]].accesses++;
+		}
+	}
+}
+
+/*
+ * Sectored caches.
+ *
+ * Lines of any power of two size from 16 to 256 bytes hold a tag for up to
+ * 16 sectors, each with its own valid and dirty bit. A miss allocates the
+ * line but fills only the sectors accessed, all those the span of the
+ * access covers, and later accesses to its other sectors fill them in
+ * turn. The fill efficiency is the part of the filled bytes that was
+ * referenced, in chunks of the trace.
+ */
+struct sector_set {
+	uint64_t tags[16];
+	uint64_t lru[16];
+	uint16_t valid[16], dirty[16], used[16];
+};
+
+static void
+sim_sectored_step(ThreadInfo *i, unsigned begin, unsigned end)
+{
+	Sectors *sc = i->sectors;
+	const uint64_t sets = ((uint64_t) i->kb * 1024 >> sc->line_log) / i->ways;
+	const unsigned chunks = sc->line_log - TRACE_CHUNK_BITS;
+	struct sector_set *cache = i->state;
+
+	if (!cache && !(cache = i->state = calloc(sets, sizeof(struct sector_set))))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	i->accesses += end - begin;
+	for (unsigned ti = begin; ti < end; ti++) {
+		const Trace trace = traces_at(&g_traces, ti);
+		const uint64_t line = TRACE_CHUNK(trace) >> chunks;
+		const unsigned chunk = TRACE_CHUNK(trace) & ((1u << chunks) - 1);
+		const unsigned last = chunk + (g_traces.spans ? g_traces.spans[ti] : 0);
+		const unsigned shift = sc->sector_log - TRACE_CHUNK_BITS;
+		const uint16_t sectors = (2u << (last >> shift)) - (1u << (chunk >> shift));
+		const uint16_t touched = (2u << last) - (1u << chunk);
+		const uint64_t set = i->index ? index_set(i->index, line, 0) : line & (sets - 1);
+		const uint32_t allowed = i->way_masks ? i->way_masks[g_streams[ti]] : UINT32_MAX;
+		struct sector_set *s = &cache[set];
+		int way = -1, victim = __builtin_ctz(allowed);
+		bool hit = false;
+
+		for (unsigned w = 0; w < i->ways; w++) {
+			s->lru[w]++;
+			if (s->valid[w] && s->tags[w] == line)
+				way = w;
+			else if ((allowed & (1u << w)) && s->valid[victim] &&
+			         (!s->valid[w] || s->lru[w] > s->lru[victim]))
+				victim = w;
+		}
+
+		if (way < 0) {
+			way = victim;
+			sc->line_misses++;
+			sc->writebacks += __builtin_popcount(s->dirty[way]);
+			s->tags[way] = line;
+			s->valid[way] = s->dirty[way] = s->used[way] = 0;
+		} else if ((s->valid[way] & sectors) != sectors) {
+			sc->sector_misses++;
+		} else {
+			hit = true;
+		}
+
+		sc->fills += __builtin_popcount(sectors & ~s->valid[way]);
+		sc->used += __builtin_popcount(touched & ~s->used[way]);
+		s->valid[way] |= sectors;
+		s->used[way] |= touched;
+		if (TRACE_OP(trace) == STORE)
+			s->dirty[way] |= sectors;
+		s->lru[way] = 0;
+
+		i->hits += hit;
+		if (i->timing)
+			timing_access(i->timing, line, hit);
+		if (i->banks)
+			bank_access(i->banks, line);
+		if (i->tenants) {
+			i->tenants[g_streams[ti]].hits += hit;
+			i->tenants[g_streams[ti]].accesses++;
+		}
+	}
+}
+
+/*
+ * PC-based replacement.
+ *
+ * SHiP (Wu et al., "Signature-based Hit Predictor") inserts lines with the
+ * SRRIP position that the Signature History Counter Table predicts for the
+ * PC inserting them: distant if lines it inserted were evicted unused,
+ * long otherwise. Hawkeye (Jain and Lin, "Back to the Future") predicts
+ * whether OPT would have cached the lines of each PC: OPTgen replays the
+ * accesses to a set and finds which reuses OPT would hit within a window
+ * of 8 times the ways, and the predictor is trained towards them. Lines
+ * that OPT would keep age in RRIP order, and the others are evicted first.
+ * Either trains only on one in stride sets, and predicts for them all.
+ */
+static void
+policy_init(Policy *p, enum policy kind, uint64_t sets, unsigned ways)
+{
+	const uint64_t sampled = sets < POLICY_SAMPLED ? sets : POLICY_SAMPLED;
+
+	*p = (Policy) {kind, calloc(sets * ways, sizeof(uint16_t)), calloc(sets * ways, sizeof(bool))};
+	memset(p->counters, kind == POLICY_SHIP ? 1 : 4, sizeof(p->counters));
+	p->stride = sets / sampled;
+	p->window = 8 * ways;
+	p->clock = calloc(sampled, sizeof(uint64_t));
+	p->occupancy = calloc(sampled * p->window, sizeof(uint8_t));
+	p->sampler = calloc(sampled * p->window, sizeof(SamplerEntry));
+	if (!p->signature || !p->reused || !p->clock || !p->occupancy || !p->sampler)
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+}
+
+static void
+policy_free(Policy *p)
+{
+	free(p->signature);
+	free(p->reused);
+	free(p->clock);
+	free(p->occupancy);
+	free(p->sampler);
+}
+
+static inline uint16_t
+policy_signature(uint64_t pc)
+{
+	return (pc ^ pc >> 14 ^ pc >> 28) % POLICY_SIGNATURES;
+}
+
+static inline void
+policy_train(Policy *p, uint16_t signature, bool up)
+{
+	uint8_t *c = &p->counters[signature];
+
+	if (up && *c < POLICY_COUNTER_MAX)
+		(*c)++;
+	else if (!up && *c)
+		(*c)--;
+}
+
+/* OPTgen: decides whether OPT would have hit the previous access to the line,
+   trains the predictor for the PC of that access and records this one */
+static void
+hawkeye_optgen(Policy *p, uint64_t slot, unsigned ways, uint64_t line, uint16_t signature)
+{
+	const uint64_t now = ++p->clock[slot];
+	uint8_t *occupancy = &p->occupancy[slot * p->window];
+	SamplerEntry *sampler = &p->sampler[slot * p->window], *e = sampler;
+
+	occupancy[now % p->window] = 0;
+	for (unsigned k = 0; k < p->window; k++) {
+		if (sampler[k].line == line + 1) {
+			e = &sampler[k];
+			break;
+		}
+		if (sampler[k].time < e->time)
+			e = &sampler[k];
+	}
+
+	if (e->line == line + 1) {
+		bool hit = now - e->time < p->window;
+
+		for (uint64_t t = e->time; hit && t < now; t++)
+			hit = occupancy[t % p->window] < ways;
+		for (uint64_t t = e->time; hit && t < now; t++)
+			occupancy[t % p->window]++;
+		policy_train(p, e->signature, hit);
+	}
+
+	*e = (SamplerEntry) {line + 1, now, signature};
+}
+
+static void
+sim_policy_step(ThreadInfo *i, unsigned begin, unsigned end)
+{
+	Policy *p = i->policy;
+	const uint64_t mask = sim_set_associative_mask(i);
+	const uint8_t rrpv_max = p->kind == POLICY_SHIP ? SHIP_RRPV_MAX : HAWKEYE_RRPV_MAX;
+	struct set *cache = sim_set_associative_cache(i, mask);
+
+	i->accesses += end - begin;
+	for (unsigned ti = begin; ti < end; ti++) {
+		const Trace trace = traces_at(&g_traces, ti);
+		const uint64_t line = TRACE_LINE(trace), tag = line << 1 | 1;
+		const uint64_t set = i->index ? index_set(i->index, line, 0) : line & mask;
+		const uint32_t allowed = i->way_masks ? i->way_masks[g_streams[ti]] : UINT32_MAX;
+		const uint16_t signature = policy_signature(g_traces.pcs[ti]);
+		const bool sampled = set % p->stride == 0 && set / p->stride < POLICY_SAMPLED;
+		struct set *s = &cache[set];
+		uint16_t *signatures = &p->signature[set * i->ways];
+		bool *reused = &p->reused[set * i->ways];
+		int way = -1;
+		bool hit, friendly;
+
+		for (unsigned w = 0; w < i->ways && way < 0; w++)
+			if (s->valid[w] && s->tags[w] == tag)
+				way = w;
+		hit = way >= 0;
+
+		if (p->kind == POLICY_HAWKEYE && sampled)
+			hawkeye_optgen(p, set / p->stride, i->ways, line, signature);
+
+		if (hit) {
+			if (p->kind == POLICY_SHIP) {
+				if (sampled && !reused[way])
+					policy_train(p, signatures[way], true);
+				reused[way] = true;
+				s->lru[way] = 0;
+			} else {
+				signatures[way] = signature;
+				s->lru[way] = p->counters[signature] >= 4 ? 0 : rrpv_max;
+			}
+		} else if (!(i->options == OPTION_WRITE_ON_MISS && TRACE_OP(trace) == STORE)) {
+			/* An invalid way, or else the most distant re-reference,
+			   aging the others to it as RRIP does */
+			uint64_t distant = 0;
+
+			for (unsigned w = 0; w < i->ways; w++) {
+				if (!(allowed & (1u << w)))
+					continue;
+				if (!s->valid[w]) {
+					way = w;
+					break;
+				}
+				if (way < 0 || s->lru[w] > distant) {
+					way = w;
+					distant = s->lru[w];
+				}
+			}
+
+			if (s->valid[way] && p->kind == POLICY_SHIP) {
+				for (unsigned w = 0; w < i->ways; w++)
+					if (allowed & (1u << w))
+						s->lru[w] += rrpv_max - distant;
+				if (sampled && !reused[way])
+					policy_train(p, signatures[way], false);
+			} else if (s->valid[way] && distant < rrpv_max) {
+				/* Hawkeye evicts a line it predicted OPT would keep */
+				policy_train(p, signatures[way], false);
+			}
+
+			friendly = p->counters[signature] >= (p->kind == POLICY_SHIP ? 1 : 4);
+			if (p->kind == POLICY_HAWKEYE && friendly)
+				for (unsigned w = 0; w < i->ways; w++)
+					if (s->valid[w] && s->lru[w] < rrpv_max - 1)
+						s->lru[w]++;
+
+			s->tags[way] = tag;
+			s->valid[way] = true;
+			signatures[way] = signature;
+			reused[way] = false;
+			if (p->kind == POLICY_SHIP)
+				s->lru[way] = friendly ? rrpv_max - 1 : rrpv_max;
+			else
+				s->lru[way] = friendly ? 0 : rrpv_max;
+		}
+
+		i->hits += hit;
+		if (i->timing)
+			timing_access(i->timing, line, hit);
+		if (i->banks)
+			bank_access(i->banks, line);
+		if (i->tenants) {
+			i->tenants[g_streams[ti]].hits += hit;
+			i->tenants[g_streams[ti]].accesses++;
+		}
+	}
+}
+
+static void *
+sim_set_associative(void *arg)
+{
+	ThreadInfo *i = arg;
+
+	sim_steps(i, 0, sim_records(i));
+	if (!i->part)
+		free(i->state);
+	i->state = NULL;
+
+	return NULL;
+}
+
+/*
+ * Fused simulation of many configurations (see fused_run), in blocks of
+ * FUSED_BYTES of records: 16384 accesses of a compact trace, 8192 of a
+ * wide one, or 8192 runs with -R, plus the first access of each run.
+ */
+#define FUSED_BYTES 65536
+
+/* Records per block, from their width */
+static unsigned
+sim_fused_block(bool runs)
+{
+	return FUSED_BYTES / (runs ? sizeof(Run) : g_traces.wide ? sizeof(Trace) : sizeof(uint32_t));
+}
+
+static unsigned
+sim_fused_records(void *arg)
+{
+	return sim_records(arg);
+}
+
+static void
+sim_fused_step(void *arg, unsigned begin, unsigned end)
+{
+	sim_steps(arg, begin, end);
+}
+
+static void
+sim_fused_done(void *arg)
+{
+	ThreadInfo *i = arg;
+
+	free(i->state);
+	i->state = NULL;
+}
+
+/*
+ * Sampled simulation.
+ *
+ * Only the units of a Sample are counted, each after warming up the caches
+ * on the records before it, which are simulated but not counted. The cache
+ * contents carry over between units, so the warm-up only has to refresh
+ * what went stale in between. Units are either periodic, when the hit rate
+ * is the ratio of the sums over all units and its confidence interval
+ * follows from the variance of that ratio across the units, or the
+ * representatives of phases (see phase_pick), scaled by their weights.
+ */
+/* A counter that went from before to after over a unit of the given weight */
+static unsigned
+sample_scale(unsigned before, unsigned after, double weight)
+{
+	return before + (unsigned) (weight * (after - before) + 0.5);
+}
+
+static void *
+sim_sampled(void *arg)
+{
+	ThreadInfo *i = arg;
+	Sample *s = i->sample;
+	const unsigned records = sim_records(i);
+	const double seconds = now_seconds();
+
+	for (unsigned u = 0, done = 0; u < s->amt; u++) {
+		const unsigned start = s->starts[u];
+		const unsigned warm = start - done < s->warm ? done : start - s->warm;
+		const unsigned end = records - start < s->unit ? records : start + s->unit;
+		const double weight = s->weights ? s->weights[u] : 1;
+		const unsigned hits = i->hits, accesses = i->accesses;
+		Tlb tlb;
+
+		if (i->tlb)
+			tlb = *i->tlb;
+		i->step(i, warm, start);
+		i->hits = hits;
+		i->accesses = accesses;
+		if (i->tlb)
+			*i->tlb = tlb;
+
+		i->step(i, start, end);
+		done = end;
+
+		const double h = i->hits - hits, a = i->accesses - accesses;
+		s->hits += h;
+		s->accesses += a;
+		s->hits2 += h * h;
+		s->accesses2 += a * a;
+		s->products += h * a;
+
+		if (weight != 1) {
+			i->hits = sample_scale(hits, i->hits, weight);
+			i->accesses = sample_scale(accesses, i->accesses, weight);
+			if (i->tlb) {
+				i->tlb->l2_hits = sample_scale(tlb.l2_hits, i->tlb->l2_hits, weight);
+				i->tlb->walks = sample_scale(tlb.walks, i->tlb->walks, weight);
+				i->tlb->walk_refs = sample_scale(tlb.walk_refs, i->tlb->walk_refs, weight);
+			}
+		}
+	}
+	i->seconds = now_seconds() - seconds;
+
+	free(i->state);
+	i->state = NULL;
+
+	return NULL;
+}
+
+/* Half width of the 95% confidence interval of the hit rate, out of the
+   total units in a trace of records */
+static double
+sample_error(const Sample *s, unsigned records)
+{
+	const double n = s->amt, r = s->hits / s->accesses, mean = s->accesses / n;
+	const double fraction = n * s->unit / records;
+	double var;
+
+	if (s->amt < 2 || !s->accesses)
+		return 1;
+
+	var = (s->hits2 - 2 * r * s->products + r * r * s->accesses2) / (n - 1);
+	return 1.96 * sqrt((fraction < 1 ? 1 - fraction : 0) * var / (n * mean * mean));
+}
+
+/* Starts a unit every period records, after its warm-up */
+static void
+sample_periodic(Sample *s, unsigned records)
+{
+	s->amt = 0;
+	if (!(s->starts = malloc((records / s->period + 1) * sizeof(unsigned))))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	for (unsigned begin = 0; records - begin > s->warm; begin += s->period) {
+		s->starts[s->amt++] = begin + s->warm;
+		if (records - begin <= s->period)
+			break;
+	}
+}
+
+/*
+ * Phase detection.
+ *
+ * The trace is cut into intervals of unit records, each summarised by a
+ * signature: the fraction of its accesses to every region of memory,
+ * hashed into PHASE_DIMS dimensions. k-means groups intervals with similar
+ * signatures into phases, starting from the intervals farthest apart. The
+ * interval nearest the centre of each phase then stands for the whole
+ * phase, weighted by the accesses of the phase over its own.
+ */
+#define PHASE_DIMS    32
+#define PHASE_REGION  11 /* log2 of the lines in a region, 64KB */
+#define PHASE_ROUNDS  100
+
+static double
+phase_distance(const float *a, const float *b)
+{
+	double d = 0;
+
+	for (int k = 0; k < PHASE_DIMS; k++)
+		d += (a[k] - b[k]) * (a[k] - b[k]);
+
+	return d;
+}
+
+/* Fills the units of s with the representatives of at most phases phases */
+static void
+phase_pick(Sample *s, unsigned phases, bool runs)
+{
+	const unsigned records = runs ? g_runs_amt : g_traces_amt;
+	const unsigned n = (records + s->unit - 1) / s->unit;
+	float (*sig)[PHASE_DIMS] = calloc(n, sizeof(*sig));
+	float (*centre)[PHASE_DIMS] = calloc(phases, sizeof(*centre));
+	double *size = calloc(n, sizeof(double)), *mass = calloc(phases, sizeof(double));
+	double *nearest = calloc(phases, sizeof(double)), *gap = calloc(n, sizeof(double));
+	unsigned *phase = calloc(n, sizeof(unsigned)), *rep = calloc(phases, sizeof(unsigned));
+
+	s->starts = malloc(phases * sizeof(unsigned));
+	s->weights = malloc(phases * sizeof(double));
+	if (!sig || !centre || !size || !mass || !nearest || !gap || !phase || !rep ||
+	    !s->starts || !s->weights)
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	if (phases > n)
+		phases = n;
+
+	for (unsigned r = 0; r < records; r++) {
+		const unsigned ti = runs ? g_runs[r].first : r, count = runs ? g_runs[r].count : 1;
+		const uint64_t region = TRACE_LINE(traces_at(&g_traces, ti)) >> PHASE_REGION;
+
+		sig[r / s->unit][(region * 0x9e3779b97f4a7c15ull) >> 59] += count;
+		size[r / s->unit] += count;
+	}
+	for (unsigned v = 0; v < n; v++)
+		for (int k = 0; k < PHASE_DIMS; k++)
+			sig[v][k] /= size[v];
+
+	/* Every next centre is the interval farthest from those chosen,
+	   keeping the distance of every interval to its nearest centre */
+	for (unsigned c = 0, far = 0; c < phases; c++) {
+		double farthest = 0;
+
+		memcpy(centre[c], sig[far], sizeof(*sig));
+		for (unsigned v = 0; v < n; v++) {
+			const double d = phase_distance(sig[v], centre[c]);
+
+			if (!c || d < gap[v])
+				gap[v] = d;
+			if (gap[v] > farthest) {
+				farthest = gap[v];
+				far = v;
+			}
+		}
+	}
+
+	for (unsigned round = 0; round < PHASE_ROUNDS; round++) {
+		unsigned members[MAX_PHASES] = {0};
+		bool moved = !round;
+
+		for (unsigned v = 0; v < n; v++) {
+			unsigned best = 0;
+
+			for (unsigned c = 1; c < phases; c++)
+				if (phase_distance(sig[v], centre[c]) < phase_distance(sig[v], centre[best]))
+					best = c;
+			moved |= phase[v] != best;
+			phase[v] = best;
+		}
+		if (!moved)
+			break;
+
+		/* Phases left without intervals keep their centre */
+		for (unsigned v = 0; v < n; v++)
+			if (!members[phase[v]]++)
+				memset(centre[phase[v]], 0, sizeof(*centre));
+		for (unsigned v = 0; v < n; v++)
+			for (int k = 0; k < PHASE_DIMS; k++)
+				centre[phase[v]][k] += sig[v][k] / members[phase[v]];
+	}
+
+	for (unsigned c = 0; c < phases; c++)
+		nearest[c] = INFINITY;
+	for (unsigned v = 0; v < n; v++) {
+		const double d = phase_distance(sig[v], centre[phase[v]]);
+
+		mass[phase[v]] += size[v];
+		if (d < nearest[phase[v]]) {
+			nearest[phase[v]] = d;
+			rep[phase[v]] = v;
+		}
+	}
+
+	s->amt = 0;
+	for (unsigned v = 0; v < n; v++)
+		if (nearest[phase[v]] < INFINITY && rep[phase[v]] == v) {
+			s->starts[s->amt] = v * s->unit;
+			s->weights[s->amt++] = mass[phase[v]] / size[v];
+		}
+
+	free(sig);
+	free(centre);
+	free(size);
+	free(mass);
+	free(nearest);
+	free(gap);
+	free(phase);
+	free(rep);
+}
+
+/*
+ * Set-parallel simulation of one cache.
+ *
+ * Sets never interact, so one scatter pass splits the trace into a
+ * sub-stream per contiguous range of sets, and every range is simulated
+ * on its own thread over a shared array of sets. A prefetch of the next
+ * line may land in the next range; it is scattered there as well, marked
+ * PART_PREFETCH_ONLY. Prefetching on a miss depends on the outcome of the
+ * access in the other range, so it is always simulated serially, as is
+ * UCP, which repartitions from every set at once.
+ */
+static void
+sim_set_parallel(ThreadInfo *info, unsigned threads)
+{
+	const uint64_t sets = ((info->kb ? info->kb : 16) * 1024) / (32 * info->ways);
+	const uint64_t mask = (info->ways == 1) ? bitmask(info->kb * 1024 / 32) : bitmask(sets);
+	const uint64_t range = (mask + threads) / threads;
+	const bool prefetch = info->ways > 1 && info->options == OPTION_PREFETCH_ALWAYS;
+	Partition *parts = calloc(threads, sizeof(Partition));
+	ThreadInfo *workers = calloc(threads, sizeof(ThreadInfo));
+	Job *jobs = calloc(threads, sizeof(Job));
+	TenantStats *stats = calloc(threads * MAX_STREAMS, sizeof(TenantStats));
+	unsigned *sizes = calloc(threads, sizeof(unsigned));
+	struct set *cache = calloc(mask + 1, sizeof(struct set));
+
+	if (!parts || !workers || !jobs || !stats || !sizes || !cache)
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	for (unsigned p = 0; p < threads; p++)
+		parts[p] = (Partition) {.first_set = p * range, .last_set = (p + 1) * range,
+		                        .cache = cache};
+
+	for (unsigned ti = 0; ti < g_traces_amt; ti++) {
+		const uint64_t line = TRACE_LINE(traces_at(&g_traces, ti));
+		const unsigned home = (line & mask) / range;
+		const unsigned next = ((line + 1) & mask) / range;
+
+		for (unsigned p = home; ; p = next) {
+			Partition *part = &parts[p];
+
+			if (part->amt == sizes[p]) {
+				sizes[p] = sizes[p] ? 2 * sizes[p] : 1 << 16;
+				traces_resize(&part->traces, part->amt, sizes[p], !g_traces.compact);
+				if (!(part->streams = realloc(part->streams, sizes[p])))
+					fprintf(stderr, "Out of memory.\n"), exit(1);
+			}
+
+			traces_put(&part->traces, part->amt, traces_at(&g_traces, ti));
+			part->streams[part->amt++] = g_streams[ti] | (p == home ? 0 : PART_PREFETCH_ONLY);
+			part->accesses += p == home;
+			part->warm += ti < g_warmup;
+
+			if (p == next || !prefetch)
+				break;
+		}
+	}
+
+	for (unsigned p = 0; p < threads; p++) {
+		workers[p] = *info;
+		workers[p].part = &parts[p];
+		workers[p].tenants = info->tenants ? &stats[p * MAX_STREAMS] : NULL;
+		jobs[p] = (Job) {sim_set_associative, &workers[p], parts[p].amt};
+	}
+
+	pool_run(jobs, threads);
+
+	for (unsigned p = 0; p < threads; p++) {
+		info->hits += workers[p].hits;
+		info->accesses += workers[p].accesses;
+
+		for (unsigned t = 0; info->tenants && t < MAX_STREAMS; t++) {
+			info->tenants[t].hits += workers[p].tenants[t].hits;
+			info->tenants[t].accesses += workers[p].tenants[t].accesses;
+		}
+
+		traces_free(&parts[p].traces);
+		free(parts[p].streams);
+	}
+
+	free(cache);
+	free(sizes);
+	free(stats);
+	free(jobs);
+	free(workers);
+	free(parts);
+}
+
+struct block {
+	uint64_t tag;
+	uint64_t lru;
+};
+
+/* Returns HIT (true) or MISS (false) */
+static inline bool
+sim_fully_associative_access(struct block *cache, uint64_t tag)
+{
+	bool hit = false;
+
+	/* Search for tag in cache */
+	for (int b = 0; b < 512; b += 8) {
+		#define SIMFA_UNROLL1(N)                      \
+		cache[((b) + (N))].lru++;                    \
+		if (!hit && cache[((b) + (N))].tag == tag) { \
+			hit = true;                      \
+			cache[((b) + (N))].lru = 0;          \
+		}
+
+		/* We are sacrificing everything here
+		   for the sole purpose of speed... */
+		SIMFA_UNROLL1(0);SIMFA_UNROLL1(1);
+		SIMFA_UNROLL1(2);SIMFA_UNROLL1(3);
+		SIMFA_UNROLL1(4);SIMFA_UNROLL1(5);
+		SIMFA_UNROLL1(6);SIMFA_UNROLL1(7);
+	}
+
+	if (!hit) {
+		bool hasempty = false;
+		unsigned lru_block = 0, lru_largest = 0;
+		for (int w = 0; w < 512; w += 8) {
+			#define SIMFA_UNROLL2(N) \
+			if (cache[w + N].lru > lru_largest) { \
+				lru_largest = cache[w + N].lru; \
+				lru_block = w + N; \
+			} \
+			if (cache[w + N].tag == 0) { \
+				cache[w + N].tag = tag; \
+				cache[w + N].lru = 0; \
+				hasempty = true; \
+				break; \
+			}
+
+			SIMFA_UNROLL2(0);SIMFA_UNROLL2(1);
+			SIMFA_UNROLL2(2);SIMFA_UNROLL2(3);
+			SIMFA_UNROLL2(4);SIMFA_UNROLL2(5);
+			SIMFA_UNROLL2(6);SIMFA_UNROLL2(7);
+		}
+
+		if (!hasempty) {
+			/* Failed to place tag in an empty block;
+			   Overwrite the least recently used block. */
+			cache[lru_block].tag = tag;
+			cache[lru_block].lru = 0;
+		}
+	}
+
+	return hit;
+}
+
+static void
+sim_fully_associative_step(ThreadInfo *i, unsigned begin, unsigned end)
+{
+	/* We are running this with 32 bytes line size
+	   and 16 KB total cache size.
+	   512 blocks * 32 bytes = 16KB cache */
+	struct block *cache = i->state;
+
+	if (!cache && !(cache = i->state = calloc(512, sizeof(struct block))))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	if (i->runs) {
+		/* The rest of a run hits, ageing every block but the
+		   first holding the tag once per access */
+		for (unsigned ri = begin; ri < end; ri++) {
+			const Run *r = &g_runs[ri];
+			const uint64_t tag = TRACE_LINE(traces_at(&g_traces, r->first));
+			const unsigned n = r->count - 1;
+			bool found = false;
+
+			i->hits += sim_fully_associative_access(cache, tag) + n;
+			i->accesses += r->count;
+
+			for (int b = 0; n && b < 512; b++) {
+				cache[b].lru += n;
+				if (!found && cache[b].tag == tag) {
+					found = true;
+					cache[b].lru = 0;
+				}
+			}
+		}
+		return;
+	}
+
+	i->accesses += end - begin;
+	for (unsigned ti = begin; ti < end; ti++) {
+		const uint64_t line = TRACE_LINE(traces_at(&g_traces, ti));
+		const bool hit = sim_fully_associative_access(cache, line);
+
+		i->hits += hit;
+		if (i->timing)
+			timing_access(i->timing, line, hit);
+	}
+}
+
+static void *
+sim_fully_associative(void *arg)
+{
+	ThreadInfo *i = arg;
+
+	sim_steps(i, 0, sim_records(i));
+	free(i->state);
+	i->state = NULL;
+
+	return NULL;
+}
+
+/* Returns HIT (true) or MISS (false) */
+static inline bool
+sim_fully_associative_pseudo_access(uint64_t *lru_cache, uint64_t tag)
+{
+	bool hit = false;
+
+	/* If we find a hit, update the path to the least recently used tag. */
+	for (int block = 511; block < 1023; block++) {
+		if (lru_cache[block] == tag) {
+			hit = true;
+
+			do
+				lru_cache[(block - 1) / 2] = (block % 2) ? 0 : 1;
+			while ((block = (block - 1) / 2));
+			break;
+		}
+	}
+
+	/* Start at first LRU bit, 0.
+	   Follow the 'coldest' path to find the least recently used tag.
+	   tmp will be set the index of the least recently used tag. */
+	int tmp = 0;
+	if(!hit) {
+		for (; tmp < 511; tmp = 2 * tmp + (!(lru_cache[tmp] = !lru_cache[tmp]) ? 1 : 2));
+		lru_cache[tmp] = tag;
+	}
+
+	return hit;
+}
+
+static void
+sim_fully_associative_pseudo_step(ThreadInfo *i, unsigned begin, unsigned end)
+{
+	/* We are running this with 32 bytes line size
+	   and 16 KB total cache size.
+	   512 blocks * 32 bytes = 16KB cache
+
+	   Combining the LRU bits and the cache will allow us
+	   to easily translate between a cache block, and it's
+	   corresponding LRU bit.
+
+	   It is possible that this approach worsens spatial locality.
+
+	   511 table bytes  indexes 0 to 510     for LRU calculation
+	   512 cache bytes  indexes 511 to 1023 for holding cached tags */
+	uint64_t *lru_cache = i->state;
+
+	if (!lru_cache && !(lru_cache = i->state = calloc(1024, sizeof(uint64_t))))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	if (i->runs) {
+		/* A hit points the path away from the block, as inserting
+		   it did, so the rest of a run hits without changing a bit */
+		for (unsigned ri = begin; ri < end; ri++) {
+			const Trace trace = traces_at(&g_traces, g_runs[ri].first);
+
+			i->hits += sim_fully_associative_pseudo_access(lru_cache, TRACE_LINE(trace)) +
+			           g_runs[ri].count - 1;
+			i->accesses += g_runs[ri].count;
+		}
+		return;
+	}
+
+	i->accesses += end - begin;
+	for (unsigned ti = begin; ti < end; ti++) {
+		const uint64_t line = TRACE_LINE(traces_at(&g_traces, ti));
+		const bool hit = sim_fully_associative_pseudo_access(lru_cache, line);
+
+		i->hits += hit;
+		if (i->timing)
+			timing_access(i->timing, line, hit);
+	}
+}
+
+static void *
+sim_fully_associative_pseudo(void *arg)
+{
+	ThreadInfo *i = arg;
+
+	sim_steps(i, 0, sim_records(i));
+	free(i->state);
+	i->state = NULL;
+
+	return NULL;
+}
+
+/*
+ * Address translation.
+ *
+ * An L1 TLB, filled from an L2 TLB, filled by walking four-level x86-64
+ * page tables. Both TLBs are set associative with LRU. The page-walk cache
+ * keeps the most recent non-leaf entries of each level, so a walk only
+ * reads the levels below the deepest entry it finds there. A single page
+ * size backs the whole trace, and the sweep translates it once per size.
+ */
+static const unsigned page_shifts[PAGE_SIZES] = {12, 21, 30};
+
+/* Whether every TLB has a power of two sets of at most 16 ways */
+static bool
+tlb_geometry_valid(const TlbGeometry *g)
+{
+	const unsigned entries[2] = {g->l1_entries, g->l2_entries}, ways[2] = {g->l1_ways, g->l2_ways};
+
+	for (int t = 0; t < 2; t++) {
+		const unsigned sets = ways[t] ? entries[t] / ways[t] : 0;
+
+		if (ways[t] < 1 || ways[t] > 16 || sets < 1 || sets * ways[t] != entries[t] ||
+		    (sets & (sets - 1)))
+			return false;
+	}
+
+	return g->pwc >= 1 && g->pwc <= 16;
+}
+
+static bool
+sim_tlb_lookup(struct set *sets, unsigned entries, unsigned ways, uint64_t page)
+{
+	const unsigned amt = entries / ways;
+
+	return sim_set_associative_do(&sets[page & bitmask(amt)], (page >> mylog2(amt)) << 1 | 1,
+	                              ways, false, UINT32_MAX);
+}
+
+static void
+sim_tlb_step(ThreadInfo *i, unsigned begin, unsigned end)
+{
+	Tlb *t = i->tlb;
+	const TlbGeometry *g = t->geometry;
+	const unsigned l1_sets = g->l1_entries / g->l1_ways, l2_sets = g->l2_entries / g->l2_ways;
+	const unsigned levels = (48 - t->page_shift) / 9;
+	struct set *l1 = i->state, *l2, *pwc;
+
+	if (!l1 && !(l1 = i->state = calloc(l1_sets + l2_sets + levels - 1, sizeof(struct set))))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+	l2 = l1 + l1_sets;
+	pwc = l2 + l2_sets;
+
+	for (unsigned r = begin; r < end; r++) {
+		const unsigned ti = i->runs ? g_runs[r].first : r;
+		const unsigned count = i->runs ? g_runs[r].count : 1;
+		const uint64_t line = TRACE_LINE(traces_at(&g_traces, ti));
+		const uint64_t page = line >> (t->page_shift - block_id_offset);
+
+		i->accesses += count;
+		if (sim_tlb_lookup(l1, g->l1_entries, g->l1_ways, page)) {
+			i->hits++;
+		} else if (sim_tlb_lookup(l2, g->l2_entries, g->l2_ways, page)) {
+			t->l2_hits++;
+		} else {
+			unsigned refs = levels;
+
+			/* Level l entries map 2^(39 - 9l) bytes */
+			for (unsigned l = 0; l + 1 < levels; l++)
+				if (sim_set_associative_do(&pwc[l], (line >> (39 - 9 * l - block_id_offset)) << 1 | 1,
+				                           g->pwc, false, UINT32_MAX))
+					refs = levels - l - 1;
+
+			t->walks++;
+			t->walk_refs += refs;
+		}
+
+		/* The rest of a run hits in the L1 TLB */
+		if (count > 1)
+			sim_set_associative_repeat(&l1[page & bitmask(l1_sets)],
+			                           (page >> mylog2(l1_sets)) << 1 | 1,
+			                           g->l1_ways, count - 1);
+		i->hits += count - 1;
+	}
+}
+
+static void *
+sim_tlb(void *arg)
+{
+	ThreadInfo *i = arg;
+
+	sim_steps(i, 0, sim_records(i));
+	free(i->state);
+	i->state = NULL;
+
+	return NULL;
+}
+
+/*
+ * Multi-core coherence.
+ *
+ * Every stream is a core with a private cache. A load miss or a store to a
+ * line that is not exclusively held goes on the interconnect, where the other
+ * caches are snooped (or, with a directory, only the holders are contacted).
+ *
+ * A request only ever touches one set index in every cache, so the sets are
+ * split between the workers, one worker per core model, and each worker
+ * replays the whole interleaved trace for its own slice of sets.
+ */
+
+enum coh_state {COH_I, COH_S, COH_E, COH_O, COH_M};
+
+struct coh_line {
+	uint64_t tag, lru;
+	uint8_t  state;
+};
+
+/* hits, accesses   per core, upgrades count as hits
+ * invalidations    copies in other caches invalidated by this core
+ * upgrades         stores to a shared or owned line
+ * transfers        misses supplied by another cache instead of memory
+ * writebacks       dirty lines of this core written back to memory
+ * transactions     requests put on the interconnect
+ * messages         snoops of the other caches (bus) or point-to-point
+ *                  messages (directory) caused by those requests
+ */
+typedef struct {
+	unsigned hits, accesses;
+	unsigned invalidations, upgrades, transfers, writebacks;
+	unsigned transactions, messages;
+} CoherenceStats;
+
+typedef struct {
+	const struct options *opts;
+	unsigned cores, sets, log;
+	uint64_t first_set, last_set;
+	struct coh_line *lines; /* [core][set][way], shared by all workers */
+	CoherenceStats stats[MAX_STREAMS];
+} CoherenceInfo;
+
+static struct coh_line *
+coh_find(CoherenceInfo *ci, unsigned core, uint64_t set, uint64_t tag)
+{
+	struct coh_line *l = &ci->lines[((uint64_t) core * ci->sets + set) * ci->opts->ways];
+
+	for (int w = 0; w < ci->opts->ways; w++)
+		if (l[w].state != COH_I && l[w].tag == tag)
+			return &l[w];
+
+	return NULL;
+}
+
+static void
+coh_fill(CoherenceInfo *ci, unsigned core, uint64_t set, uint64_t tag,
+         enum coh_state state, uint64_t now)
+{
+	struct coh_line *l = &ci->lines[((uint64_t) core * ci->sets + set) * ci->opts->ways];
+	struct coh_line *victim = &l[0];
+
+	/* Prefer an invalid line, otherwise evict the least recently used */
+	for (int w = 0; w < ci->opts->ways; w++) {
+		if (l[w].state == COH_I) {
+			victim = &l[w];
+			break;
+		}
+		if (l[w].lru < victim->lru)
+			victim = &l[w];
+	}
+
+	if (victim->state == COH_M || victim->state == COH_O)
+		ci->stats[core].writebacks++;
+
+	*victim = (struct coh_line) {tag, now, state};
+}
+
+static void
+coh_access(CoherenceInfo *ci, unsigned core, uint64_t set, uint64_t tag,
+           bool store, uint64_t now)
+{
+	CoherenceStats *st = &ci->stats[core];
+	struct coh_line *mine = coh_find(ci, core, set, tag);
+	unsigned holders = 0, contacted = 0;
+	bool supplied = false;
+
+	st->accesses++;
+	if (mine) {
+		st->hits++;
+		mine->lru = now;
+
+		if (!store || mine->state == COH_M)
+			return;
+
+		if (mine->state == COH_E) {
+			mine->state = COH_M; /* Silent upgrade */
+			return;
+		}
+
+		st->upgrades++;
+	}
+
+	st->transactions++;
+	for (unsigned c = 0; c < ci->cores; c++) {
+		struct coh_line *l;
+
+		if (c == core || !(l = coh_find(ci, c, set, tag)))
+			continue;
+
+		holders++;
+		if (store) {
+			if (!mine && l->state != COH_S)
+				supplied = true;
+			l->state = COH_I;
+			st->invalidations++;
+			contacted++;
+			continue;
+		}
+
+		switch (l->state) {
+		case COH_M:
+			if (ci->opts->moesi) {
+				l->state = COH_O;
+			} else {
+				l->state = COH_S;
+				ci->stats[c].writebacks++; /* The owner's dirty line */
+			}
+			supplied = true;
+			contacted++;
+			break;
+		case COH_E:
+			l->state = COH_S;
+			supplied = true;
+			contacted++;
+			break;
+		case COH_O:
+			supplied = true;
+			contacted++;
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (supplied)
+		st->transfers++;
+
+	/* A bus snoops every other cache. A directory sends the request and
+	   its reply, plus a forward or invalidation and its ack per holder. */
+	st->messages += ci->opts->directory ? 2 + 2 * contacted : ci->cores - 1;
+
+	if (mine)
+		mine->state = COH_M;
+	else
+		coh_fill(ci, core, set, tag, store ? COH_M : holders ? COH_S : COH_E, now);
+}
+
+static void *
+sim_coherence(void *arg)
+{
+	CoherenceInfo *ci = arg;
+	const uint64_t mask = bitmask(ci->sets);
+
+	for (unsigned ti = 0; ti < g_traces_amt; ti++) {
+		const Trace trace = traces_at(&g_traces, ti);
+		uint64_t line = TRACE_LINE(trace);
+		uint64_t set = line & mask;
+
+		if (set >= ci->first_set && set < ci->last_set)
+			coh_access(ci, g_streams[ti], set, line >> ci->log,
+			           TRACE_OP(trace) == STORE, ti + 1);
+
+		/* After the access, so a warm-up of the whole trace counts none */
+		if (ti + 1 == g_warmup)
+			memset(ci->stats, 0, sizeof(ci->stats));
+	}
+
+	return NULL;
+}
+
+static void
+run_coherence(FILE *output, const struct options *opts, unsigned cores)
+{
+	const unsigned sets = opts->kb * 1024 / (32 * opts->ways);
+	CoherenceInfo *workers = calloc(cores, sizeof(CoherenceInfo));
+	Job *jobs = calloc(cores, sizeof(Job));
+	struct coh_line *lines = calloc((size_t) cores * sets * opts->ways, sizeof(struct coh_line));
+	CoherenceStats total[MAX_STREAMS] = {{0}};
+
+	if (!workers || !jobs || !lines)
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	for (unsigned w = 0; w < cores; w++) {
+		workers[w] = (CoherenceInfo) {opts, cores, sets, mylog2(sets),
+		                              (uint64_t) sets * w / cores,
+		                              (uint64_t) sets * (w + 1) / cores, lines};
+		jobs[w] = (Job) {sim_coherence, &workers[w], 1};
+	}
+
+	pool_run(jobs, cores);
+
+	for (unsigned w = 0; w < cores; w++) {
+		for (unsigned c = 0; c < cores; c++) {
+			CoherenceStats *s = &workers[w].stats[c], *t = &total[c];
+			t->hits += s->hits;
+			t->accesses += s->accesses;
+			t->invalidations += s->invalidations;
+			t->upgrades += s->upgrades;
+			t->transfers += s->transfers;
+			t->writebacks += s->writebacks;
+			t->transactions += s->transactions;
+			t->messages += s->messages;
+		}
+	}
+
+	/* One line per core, then the interconnect traffic of all cores */
+	unsigned transactions = 0, messages = 0;
+	for (unsigned c = 0; c < cores; c++) {
+		fprintf(output, "%d,%d; %d,%d,%d,%d;\n", total[c].hits, total[c].accesses,
+		        total[c].invalidations, total[c].upgrades,
+		        total[c].transfers, total[c].writebacks);
+		transactions += total[c].transactions;
+		messages += total[c].messages;
+	}
+	fprintf(output, "%d,%d;\n", transactions, messages);
+
+	free(lines);
+	free(jobs);
+	free(workers);
+}
+
+/* Mean latency of the accesses, in cycles */
+static double
+timing_amat(const ThreadInfo *i)
+{
+	return i->accesses ? (double) i->timing->latency / i->accesses : 0;
+}
+
+/* Prints cycles,amat,stalls,merged */
+static void
+print_timing(FILE *output, const ThreadInfo *i)
+{
+	fprintf(output, "%" PRIu64 ",%.4f,%" PRIu64 ",%" PRIu64 ";\n", timing_cycles(i->timing),
+	        timing_amat(i), i->timing->stalls, i->timing->merged);
+}
+
+/* Checkpoints of the shared cache (see Checkpoint): the tag, recency and
+   valid bits of the ways in use, the sector bits of sectored lines and the
+   SHiP or Hawkeye tables. Timing and banks start afresh. */
+#define CHECKPOINT_MAGIC "CSIMCKP1"
+
+/* Writes or reads the state of the shared cache i of the given sets */
+static void
+checkpoint_shared(const char *path, bool write, ThreadInfo *i, uint64_t sets,
+                  const struct options *opts)
+{
+	const uint64_t header[] = {opts->kb, opts->ways, opts->line_bytes, opts->sector_bytes,
+	                           opts->indexing, opts->policy, sets};
+	static const char *const names[] = {"kb", "ways", "line bytes", "sector bytes",
+	                                    "indexing", "policy", "sets"};
+	Checkpoint c = checkpoint_open(path, write, CHECKPOINT_MAGIC, header, names,
+	                               sizeof(header) / sizeof(header[0]),
+	                               "does not match the shared cache");
+	const size_t size = i->sectors ? sizeof(struct sector_set) : sizeof(struct set);
+
+	if (!i->state && !(i->state = calloc(sets, size)))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	for (uint64_t set = 0; set < sets; set++) {
+		if (i->sectors) {
+			struct sector_set *s = &((struct sector_set *) i->state)[set];
+
+			checkpoint_field(&c, s->tags, i->ways * sizeof(s->tags[0]));
+			checkpoint_field(&c, s->lru, i->ways * sizeof(s->lru[0]));
+			checkpoint_field(&c, s->valid, i->ways * sizeof(s->valid[0]));
+			checkpoint_field(&c, s->dirty, i->ways * sizeof(s->dirty[0]));
+			checkpoint_field(&c, s->used, i->ways * sizeof(s->used[0]));
+		} else {
+			struct set *s = &((struct set *) i->state)[set];
+
+			checkpoint_field(&c, s->tags, i->ways * sizeof(s->tags[0]));
+			checkpoint_field(&c, s->lru, i->ways * sizeof(s->lru[0]));
+			checkpoint_field(&c, s->valid, i->ways * sizeof(s->valid[0]));
+
+			/* Skewed recency is the time of the last access */
+			for (unsigned w = 0; !write && i->index && i->index->kind == INDEX_SKEW && w < i->ways; w++)
+				if (s->lru[w] > i->clock)
+					i->clock = s->lru[w];
+		}
+	}
+
+	if (i->policy) {
+		Policy *p = i->policy;
+		const uint64_t sampled = sets < POLICY_SAMPLED ? sets : POLICY_SAMPLED;
+
+		checkpoint_field(&c, p->signature, sets * i->ways * sizeof(p->signature[0]));
+		checkpoint_field(&c, p->reused, sets * i->ways * sizeof(p->reused[0]));
+		checkpoint_field(&c, p->counters, sizeof(p->counters));
+		checkpoint_field(&c, p->clock, sampled * sizeof(p->clock[0]));
+		checkpoint_field(&c, p->occupancy, sampled * p->window * sizeof(p->occupancy[0]));
+		checkpoint_field(&c, p->sampler, sampled * p->window * sizeof(p->sampler[0]));
+	}
+
+	checkpoint_close(&c);
+}
+
+/*
+ * Shared cache contention.
+ *
+ * Every stream is a tenant of one shared set associative cache, such as a
+ * last level cache shared by co-located services.
+ */
+static void
+run_shared(FILE *output, const struct options *opts, unsigned tenants)
+{
+	TenantStats stats[MAX_STREAMS] = {{0}};
+	UtilityMonitor ucp;
+	Timing timing = {&opts->timing};
+	Banks banks = {&opts->banks};
+	const unsigned line = opts->line_bytes ? opts->line_bytes : 32;
+	Index index = index_of(opts->indexing, opts->kb * 1024 / (line * opts->ways));
+	Sectors sectors = {mylog2(line), mylog2(opts->sector_bytes)};
+	Policy policy;
+	uint32_t masks[MAX_STREAMS];
+	bool plain;
+	ThreadInfo info = {0, 0, .kb = opts->kb, .ways = opts->ways,
+	                   .options = opts->option, .tenants = stats,
+	                   .step = sim_set_associative_step};
+
+	/* Tenants without a mask of their own may fill any way */
+	if (opts->way_masks_amt || opts->epoch) {
+		for (unsigned t = 0; t < tenants; t++)
+			masks[t] = t < opts->way_masks_amt ? opts->way_masks[t] : (1u << opts->ways) - 1;
+		info.way_masks = masks;
+	}
+
+	if (opts->epoch) {
+		ucp_init(&ucp, opts->ways, opts->kb * 1024 / (32 * opts->ways), tenants, opts->epoch,
+		         opts->indexing ? &index : NULL);
+		memcpy(ucp.masks, masks, sizeof(masks));
+		info.way_masks = ucp.masks;
+		info.ucp = &ucp;
+	}
+
+	/* Timing and banks follow the accesses in order, so they run serially */
+	if (opts->timing.mshrs)
+		info.timing = &timing;
+	if (opts->banks.banks)
+		info.banks = &banks;
+	if (opts->indexing)
+		info.index = &index;
+
+	/* Sectored lines and PC-based replacement have engines of their own */
+	if (opts->line_bytes) {
+		info.sectors = &sectors;
+		info.step = sim_sectored_step;
+	}
+	if (opts->policy) {
+		policy_init(&policy, opts->policy, info.index ? index.sets : sim_set_associative_mask(&info) + 1,
+		            opts->ways);
+		info.policy = &policy;
+		info.step = sim_policy_step;
+	}
+
+	/* Set ranges and runs need the set mask and the plain engine, and
+	   checkpoints the whole cache in one piece */
+	plain = !info.timing && !info.banks && !info.index && !info.sectors && !info.policy;
+	if (opts->threads > 1 && !opts->epoch && plain && opts->option != OPTION_PREFETCH_ON_MISS &&
+	    !opts->checkpoint && !opts->resume) {
+		sim_set_parallel(&info, opts->threads);
+	} else {
+		const uint64_t sets = info.sectors ? ((uint64_t) opts->kb * 1024 >> sectors.line_log) / opts->ways :
+		                      info.index ? index.sets : sim_set_associative_mask(&info) + 1;
+
+		if (opts->set_index && plain)
+			info.set_index = set_index_of(sim_set_associative_mask(&info));
+		info.runs = opts->runs && !opts->epoch && plain;
+		if (opts->resume)
+			checkpoint_shared(opts->resume, false, &info, sets, opts);
+		sim_steps(&info, 0, sim_records(&info));
+		if (opts->checkpoint)
+			checkpoint_shared(opts->checkpoint, true, &info, sets, opts);
+		free(info.state);
+	}
+
+	/* One line per tenant, then the totals and the final way masks */
+	for (unsigned t = 0; t < tenants; t++)
+		fprintf(output, "%d,%d;\n", stats[t].hits, stats[t].accesses);
+	fprintf(output, "%d,%d;\n", info.hits, info.accesses);
+
+	if (info.way_masks) {
+		for (unsigned t = 0; t < tenants; t++)
+			fprintf(output, "%#x; ", info.way_masks[t]);
+		fprintf(output, "\n");
+	}
+
+	if (info.timing)
+		print_timing(output, &info);
+	if (info.banks)
+		fprintf(output, "%" PRIu64 ",%" PRIu64 ";\n", banks.cycles, banks.conflicts);
+	if (g_crossings)
+		fprintf(output, "crossings,%u;\n", g_crossings);
+	if (info.sectors)
+		fprintf(output, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.4f;\n",
+		        sectors.line_misses, sectors.sector_misses, sectors.fills, sectors.writebacks,
+		        sectors.fills ? (double) (sectors.used << TRACE_CHUNK_BITS) /
+		                        (sectors.fills << sectors.sector_log) : 0);
+
+	if (opts->epoch)
+		free(ucp.tags);
+	if (opts->policy)
+		policy_free(&policy);
+}
+
+/*
+ * Split and unified L1.
+ *
+ * One pass over the trace simulates split L1I and L1D caches of the given
+ * geometry, instruction fetches going to the L1I and loads and stores to
+ * the L1D, and a unified L1 of their combined size taking all of them.
+ */
+static void
+run_l1(FILE *output, const struct options *opts)
+{
+	TenantStats stats[2][3] = {{{0}}};
+	ThreadInfo l1[3] = {
+		{0, 0, .kb = opts->kb, .ways = opts->ways, .options = opts->option},
+		{0, 0, .kb = opts->kb, .ways = opts->ways, .options = opts->option},
+		{0, 0, .kb = 2 * opts->kb, .ways = opts->ways, .options = opts->option},
+	};
+	struct set *caches[3];
+	uint64_t masks[3];
+
+	for (int c = 0; c < 3; c++) {
+		masks[c] = sim_set_associative_mask(&l1[c]);
+		caches[c] = sim_set_associative_cache(&l1[c], masks[c]);
+	}
+
+	for (unsigned ti = 0; ti < g_traces_amt; ti++) {
+		const Trace trace = traces_at(&g_traces, ti);
+		const uint64_t line = TRACE_LINE(trace);
+		const unsigned op = TRACE_OP(trace);
+
+		/* The L1I or the L1D, then the unified L1 */
+		for (int k = 0; k < 2; k++) {
+			const int c = k ? 2 : op == FETCH ? 0 : 1;
+			const bool hit = sim_set_associative_access(&l1[c], caches[c], masks[c],
+			                                            mylog2(masks[c] + 1), line,
+			                                            line & masks[c], op == STORE, UINT32_MAX);
+
+			stats[k][op].hits += hit;
+			stats[k][op].accesses++;
+		}
+
+		/* After the access, as for the coherence stats */
+		if (ti + 1 == g_warmup)
+			memset(stats, 0, sizeof(stats));
+	}
+
+	/* A line for the split caches and one for the unified, each with the
+	   fetches, loads and stores */
+	for (int k = 0; k < 2; k++)
+		fprintf(output, "%d,%d; %d,%d; %d,%d;\n", stats[k][FETCH].hits, stats[k][FETCH].accesses,
+		        stats[k][LOAD].hits, stats[k][LOAD].accesses,
+		        stats[k][STORE].hits, stats[k][STORE].accesses);
+	if (g_crossings)
+		fprintf(output, "crossings,%u;\n", g_crossings);
+
+	for (int c = 0; c < 3; c++)
+		free(caches[c]);
+}
+
+/*
+ * Reuse distance and working set.
+ *
+ * The reuse distance of an access is the number of distinct lines accessed
+ * since the previous access to its line, so a fully associative LRU cache
+ * of C lines hits exactly the accesses at distances below C. Every line
+ * marks the slot of its last access in a Fenwick tree, and the distance is
+ * the number of marks after the slot of the previous access. Slots are
+ * renumbered once they run out, keeping the tree at twice the lines seen,
+ * so an access costs O(log M) for M distinct lines.
+ *
+ * The average working set over all windows of w accesses follows from the
+ * reuse times and the first and last access times (Xiang et al., "All-window
+ * profiling"). Their sums are kept per power of two, (2^(b-1), 2^b], which
+ * makes it exact for windows of a power of two accesses.
+ */
+#define REUSE_BUCKETS 65
+#define REUSE_FREE    UINT32_MAX
+
+typedef struct {
+	uint64_t key;          /* line plus 1, 0 when empty */
+	uint64_t first, last;  /* access times, from 1 */
+	unsigned slot;
+} ReuseLine;
+
+/* lines     open addressed by line, with amt of size used
+ * tree      Fenwick tree over slots, counting the marks
+ * owner     line marking each slot, or REUSE_FREE
+ * distance  accesses by reuse distance, distance 0 in bucket 0 and
+ *           [2^(b-1), 2^b) in bucket b
+ * times     reuse, first and reverse last access times, with their sums
+ */
+typedef struct {
+	ReuseLine *lines;
+	unsigned size, amt;
+	unsigned *tree, *owner;
+	unsigned slots, next;
+	uint64_t now, cold;
+	uint64_t distance[REUSE_BUCKETS];
+	uint64_t times[REUSE_BUCKETS], time_sums[REUSE_BUCKETS];
+} Reuse;
+
+static unsigned
+reuse_marks(const Reuse *r, unsigned slot)
+{
+	unsigned marks = 0;
+
+	for (slot++; slot; slot &= slot - 1)
+		marks += r->tree[slot - 1];
+
+	return marks;
+}
+
+static void
+reuse_mark(Reuse *r, unsigned slot, int delta)
+{
+	for (slot++; slot <= r->slots; slot += slot & -slot)
+		r->tree[slot - 1] += delta;
+}
+
+static void
+reuse_time(Reuse *r, uint64_t time)
+{
+	const unsigned b = time > 1 ? 64 - __builtin_clzll(time - 1) : 0;
+
+	r->times[b]++;
+	r->time_sums[b] += time;
+}
+
+/* Renumbers the marks from 0 in the same order, into twice the slots */
+static void
+reuse_compact(Reuse *r)
+{
+	unsigned marks = 0;
+
+	for (unsigned s = 0; s < r->next; s++)
+		if (r->owner[s] != REUSE_FREE) {
+			r->lines[r->owner[s]].slot = marks;
+			r->owner[marks++] = r->owner[s];
+		}
+
+	r->slots = 2 * marks > 1 << 16 ? 2 * marks : 1 << 16;
+	r->tree = realloc(r->tree, r->slots * sizeof(unsigned));
+	r->owner = realloc(r->owner, r->slots * sizeof(unsigned));
+	if (!r->tree || !r->owner)
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	/* Build the tree bottom up in linear time */
+	for (unsigned s = 0; s < r->slots; s++)
+		r->tree[s] = s < marks;
+	for (unsigned s = 1; s <= r->slots; s++)
+		if (s + (s & -s) <= r->slots)
+			r->tree[s + (s & -s) - 1] += r->tree[s - 1];
+
+	r->next = marks;
+}
+
+static ReuseLine *
+reuse_find(Reuse *r, uint64_t line)
+{
+	unsigned h = (line * 0x9e3779b97f4a7c15ull) >> 32 & (r->size - 1);
+
+	while (r->lines[h].key && r->lines[h].key != line + 1)
+		h = (h + 1) & (r->size - 1);
+
+	return &r->lines[h];
+}
+
+/* Doubles the table, moving the slot owners along with their lines */
+static void
+reuse_grow(Reuse *r)
+{
+	ReuseLine *old = r->lines;
+	const unsigned size = r->size;
+
+	r->size = size ? 2 * size : 1 << 16;
+	if (!(r->lines = calloc(r->size, sizeof(ReuseLine))))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	for (unsigned h = 0; h < size; h++)
+		if (old[h].key) {
+			ReuseLine *l = reuse_find(r, old[h].key - 1);
+
+			*l = old[h];
+			r->owner[l->slot] = l - r->lines;
+		}
+	free(old);
+}
+
+/* Accounts for count accesses to line, all but the first repeating it */
+static void
+reuse_access(Reuse *r, uint64_t line, unsigned count)
+{
+	ReuseLine *l;
+
+	if (2 * (r->amt + 1) > r->size)
+		reuse_grow(r);
+	if (r->next == r->slots)
+		reuse_compact(r);
+
+	l = reuse_find(r, line);
+	r->now++;
+	if (!l->key) {
+		*l = (ReuseLine) {line + 1, r->now};
+		r->amt++;
+		r->cold++;
+	} else {
+		const unsigned d = reuse_marks(r, r->next - 1) - reuse_marks(r, l->slot);
+
+		r->distance[d ? 32 - __builtin_clz(d) : 0]++;
+		reuse_time(r, r->now - l->last);
+		reuse_mark(r, l->slot, -1);
+		r->owner[l->slot] = REUSE_FREE;
+	}
+
+	l->slot = r->next++;
+	reuse_mark(r, l->slot, 1);
+	r->owner[l->slot] = l - r->lines;
+
+	/* Repeats are at distance 0 and time 1 */
+	r->distance[0] += count - 1;
+	r->times[0] += count - 1;
+	r->time_sums[0] += count - 1;
+	r->now += count - 1;
+	l->last = r->now;
+}
+
+/* Writes the reuse distance histogram, a line per bucket with its least
+   distance, then cold misses, and after an empty line the average working
+   set in lines of every power of two window */
+static void
+run_reuse(FILE *output, const struct options *opts)
+{
+	Reuse r = {0};
+	unsigned last = 0;
+
+	reuse_compact(&r);
+	reuse_grow(&r);
+
+	if (opts->runs)
+		for (unsigned ri = 0; ri < g_runs_amt; ri++)
+			reuse_access(&r, TRACE_LINE(traces_at(&g_traces, g_runs[ri].first)), g_runs[ri].count);
+	else
+		for (unsigned ti = 0; ti < g_traces_amt; ti++)
+			reuse_access(&r, TRACE_LINE(traces_at(&g_traces, ti)), 1);
+
+	for (unsigned h = 0; h < r.size; h++)
+		if (r.lines[h].key) {
+			reuse_time(&r, r.lines[h].first);
+			reuse_time(&r, r.now + 1 - r.lines[h].last);
+		}
+
+	for (unsigned b = 0; b < REUSE_BUCKETS; b++)
+		if (r.distance[b])
+			last = b;
+	for (unsigned b = 0; r.now && b <= last; b++)
+		fprintf(output, "%llu,%llu;\n", b ? 1ull << (b - 1) : 0ull,
+		        (unsigned long long) r.distance[b]);
+	fprintf(output, "cold,%llu;\n\n", (unsigned long long) r.cold);
+
+	for (unsigned k = 0; r.now && (1ull << k) <= r.now; k++) {
+		const uint64_t w = 1ull << k;
+		double excess = 0;
+
+		for (unsigned b = k + 1; b < REUSE_BUCKETS; b++)
+			excess += (double) r.time_sums[b] - (double) w * r.times[b];
+		fprintf(output, "%llu,%.3f;\n", (unsigned long long) w,
+		        r.amt - excess / (r.now - w + 1));
+	}
+
+	free(r.lines);
+	free(r.tree);
+	free(r.owner);
+}
+
+/* Reads the accesses compact, widening all of them at the first that
+   does not fit. Lines are "OP ADDR [SIZE [PC [TIME]]]", with the address
+   and PC in hex, and an access of SIZE bytes crossing into further lines
+   is split into an access per line. */
+static Traces
+read_trace(const char *path, unsigned *amt, unsigned line_log)
+{
+	FILE *input;
+	uint64_t addr, pc, time;
+	unsigned bytes;
+	char behavior, text[256];
+	unsigned size = 1 << 20;
+	Traces traces = {malloc(size * sizeof(uint32_t)), NULL};
+
+	if (!traces.compact || !(input = fopen(path, "r")))
+		fprintf(stderr, "Failed to open files.\n"), exit(1);
+
+	*amt = 0;
+	while (fgets(text, sizeof(text), input)) {
+		const int fields = sscanf(text, " %c %" SCNx64 " %u %" SCNx64 " %" SCNu64, &behavior,
+		                          &addr, &bytes, &pc, &time);
+		if (fields < 2)
+			continue;
+
+		const uint64_t end = fields > 2 && bytes ? addr + bytes : addr + 1;
+		const uint64_t last = (end - 1) >> line_log;
+
+		g_crossings += last > addr >> line_log;
+
+		do {
+			const uint64_t next = ((addr >> line_log) + 1) << line_log;
+			const uint64_t stop = end < next ? end : next;
+			const Trace trace = (addr >> TRACE_CHUNK_BITS) << TRACE_OP_BITS |
+			                    (behavior == 'L' ? LOAD : behavior == 'I' ? FETCH : STORE);
+			const bool widen = traces.compact && trace > TRACE_COMPACT_MAX;
+
+			if (*amt == MAX_ACCESSES)
+				fprintf(stderr, "%s has more than %u accesses.\n", path, MAX_ACCESSES), exit(1);
+			if (*amt == size || widen)
+				traces_resize(&traces, *amt, *amt < size ? size :
+				              (size = size < MAX_ACCESSES / 2 ? 2 * size : MAX_ACCESSES), widen);
+			traces_column(&traces.pcs, size, *amt, fields > 3, fields > 3 ? pc : 0);
+			traces_column(&traces.times, size, *amt, fields > 4, fields > 4 ? time : 0);
+			traces_span(&traces, size, *amt, ((stop - 1) >> TRACE_CHUNK_BITS) - (addr >> TRACE_CHUNK_BITS));
+			traces_put(&traces, (*amt)++, trace);
+			addr = next;
+		} while (addr >> line_log <= last);
+	}
+	fclose(input);
+
+	return traces;
+}
+
+/*
+ * Run-length collapse.
+ *
+ * Accesses repeating the line just accessed by the same stream are hits in
+ * every engine here, so collapse_runs() turns them into one record. Engines
+ * consuming g_runs simulate the first access of a run and then apply the
+ * remaining hits in bulk, with exactly the results of the full trace. Runs
+ * end when the counters would overflow, at the end of the warm-up and at
+ * the end of every interval of the series.
+ */
+static void
+collapse_runs(void)
+{
+	unsigned size = 1 << 16;
+
+	if (!(g_runs = malloc(size * sizeof(Run))))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	g_runs_amt = 0;
+	for (unsigned ti = 0; ti < g_traces_amt; ti++) {
+		const Trace trace = traces_at(&g_traces, ti);
+		const bool store = TRACE_OP(trace) == STORE;
+		Run *r = g_runs_amt ? &g_runs[g_runs_amt - 1] : NULL;
+
+		if (r && ti != g_warmup &&
+		    !(g_interval && ti > g_warmup && (ti - g_warmup) % g_interval == 0) &&
+		    TRACE_LINE(traces_at(&g_traces, r->first)) == TRACE_LINE(trace) &&
+		    r->stream == g_streams[ti] && r->count < UINT16_MAX &&
+		    !(store && RUN_LEADING(r) == r->count && r->count == RUN_LEADING_MAX)) {
+			if (store)
+				r->stores = (r->stores | RUN_STORE_SEEN) + (RUN_LEADING(r) == r->count);
+			r->count++;
+			continue;
+		}
+
+		if (g_runs_amt == size && !(g_runs = realloc(g_runs, (size *= 2) * sizeof(Run))))
+			fprintf(stderr, "Out of memory.\n"), exit(1);
+
+		g_runs_warm += ti < g_warmup;
+		g_runs[g_runs_amt++] = (Run) {ti, 1, g_streams[ti],
+		                              store ? RUN_STORE_SEEN | 1 : 0};
+	}
+}
+
+/* Merges the streams into g_traces, recording the source of every access in
+   g_streams. Round robin takes quantum accesses from each stream in turn.
+   Proportional advances every stream at a rate relative to its length, so
+   that all streams start and finish together. By time takes the earliest
+   timestamp next, from the first stream on ties. */
+static void
+interleave_traces(Traces streams[], unsigned amts[], unsigned n,
+                  enum interleave policy, unsigned quantum)
+{
+	unsigned pos[MAX_STREAMS] = {0};
+	uint64_t total = 0;
+	bool wide = false;
+
+	for (unsigned s = 0; s < n; s++) {
+		total += amts[s];
+		wide |= !streams[s].compact;
+	}
+	if (total > MAX_ACCESSES)
+		fprintf(stderr, "The inputs have more than %u accesses.\n", MAX_ACCESSES), exit(1);
+	g_traces_amt = total;
+
+	g_traces = (Traces) {NULL};
+	traces_resize(&g_traces, 0, g_traces_amt, wide);
+	if (!(g_streams = malloc(g_traces_amt)))
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	for (unsigned ti = 0, s = 0, q = 0; ti < g_traces_amt; ) {
+		if (policy == INTERLEAVE_TIME) {
+			s = n;
+			for (unsigned c = 0; c < n; c++)
+				if (pos[c] < amts[c] && (s == n || streams[c].times[pos[c]] < streams[s].times[pos[s]]))
+					s = c;
+		} else if (policy == INTERLEAVE_PROPORTIONAL) {
+			/* Pick the stream whose next access is due first */
+			s = n;
+			for (unsigned c = 0; c < n; c++)
+				if (pos[c] < amts[c] && (s == n ||
+				    (uint64_t) (pos[c] + 1) * amts[s] < (uint64_t) (pos[s] + 1) * amts[c]))
+					s = c;
+		} else if (pos[s] == amts[s] || q == quantum) {
+			s = (s + 1) % n;
+			q = 0;
+			continue;
+		}
+
+		traces_column(&g_traces.pcs, g_traces_amt, ti, streams[s].pcs,
+		              streams[s].pcs ? streams[s].pcs[pos[s]] : 0);
+		traces_column(&g_traces.times, g_traces_amt, ti, streams[s].times,
+		              streams[s].times ? streams[s].times[pos[s]] : 0);
+		traces_span(&g_traces, g_traces_amt, ti, streams[s].spans ? streams[s].spans[pos[s]] : 0);
+		traces_put(&g_traces, ti, traces_at(&streams[s], pos[s]++));
+		g_streams[ti++] = s;
+		q++;
+	}
+}
+
+/* Structured output of the sweep (see enum format) */
+static const char *const option_names[] = {"none", "wom", "pfa", "pfm"};
+static const char *const index_names[] = {"legacy", "mod", "xor", "prime", "skew"};
+
+typedef struct {
+	const char *engine, *policy, *option, *index;
+	unsigned kb, ways, sets, page_kb;
+} Config;
+
+static Config
+sweep_config(const ThreadInfo *i)
+{
+	const unsigned kb = i->kb ? i->kb : 16;
+
+	if (i->tlb) {
+		const TlbGeometry *g = i->tlb->geometry;
+
+		return (Config) {"tlb", "lru", "none", "legacy", 0, g->l1_ways,
+		                 g->l1_entries / g->l1_ways, 1u << (i->tlb->page_shift - 10)};
+	}
+	if (i->step == sim_fully_associative_step)
+		return (Config) {"fully_associative", "lru", "none", "legacy", 16, 512, 1};
+	if (i->step == sim_fully_associative_pseudo_step)
+		return (Config) {"fully_associative", "plru", "none", "legacy", 16, 512, 1};
+	if (i->ways == 1)
+		return (Config) {"direct", "none", "none", index_names[i->index ? i->index->kind : 0],
+		                 kb, 1, kb * 1024 / 32};
+
+	return (Config) {"set_associative", "lru", option_names[i->options],
+	                 index_names[i->index ? i->index->kind : 0], kb, i->ways,
+	                 kb * 1024 / (32 * i->ways)};
+}
+
+/* Prints the record of a result, with its series in JSON */
+static void
+print_record(FILE *output, enum format format, const ThreadInfo *i, const Banks *banks,
+             unsigned intervals)
+{
+	const Config c = sweep_config(i);
+	const Banks *b = i->step == sim_set_associative_step ? banks : NULL;
+	const double rate = i->accesses ? (double) i->hits / i->accesses : 0;
+	const double speed = i->seconds > 0 ? i->accesses / i->seconds : 0;
+	const bool error = i->sample && !i->sample->weights;
+
+	if (format == FORMAT_CSV) {
+		fprintf(output, "%s,%u,%u,%u,32,%s,%s,%s,%u,%u,%u,%u,%u,%.6f,%.6f,", c.engine, c.kb,
+		        c.ways, c.sets, c.policy, c.option, c.index, c.page_kb, g_warmup, i->hits,
+		        i->accesses, i->accesses - i->hits, rate, 1 - rate);
+		if (error)
+			fprintf(output, "%.6f", sample_error(i->sample, sim_records(i)));
+		fprintf(output, ",%.6f,%.0f,", i->seconds, speed);
+		if (i->tlb)
+			fprintf(output, "%u,%u,%u", i->tlb->l2_hits, i->tlb->walks, i->tlb->walk_refs);
+		else
+			fprintf(output, ",,");
+		if (i->timing)
+			fprintf(output, ",%u,%u,%u,%" PRIu64 ",%.4f,%" PRIu64 ",%" PRIu64,
+			        i->timing->params->hit, i->timing->params->dram, i->timing->params->mshrs,
+			        timing_cycles(i->timing), timing_amat(i), i->timing->stalls,
+			        i->timing->merged);
+		else
+			fprintf(output, ",,,,,,,");
+		if (b)
+			fprintf(output, ",%u,%u,%" PRIu64 ",%" PRIu64, b->params->banks, b->params->width,
+			        b->cycles, b->conflicts);
+		else
+			fprintf(output, ",,,,");
+		fprintf(output, ",%u\n", g_crossings);
+		return;
+	}
+
+	fprintf(output, "{\"engine\": \"%s\", \"kb\": %u, \"ways\": %u, \"sets\": %u, "
+	        "\"line_bytes\": 32, \"policy\": \"%s\", \"option\": \"%s\", \"index\": \"%s\", "
+	        "\"warmup\": %u, ", c.engine, c.kb, c.ways, c.sets, c.policy, c.option, c.index,
+	        g_warmup);
+	if (i->tlb)
+		fprintf(output, "\"page_kb\": %u, \"l2_hits\": %u, \"walks\": %u, \"walk_refs\": %u, ",
+		        c.page_kb, i->tlb->l2_hits, i->tlb->walks, i->tlb->walk_refs);
+	fprintf(output, "\"hits\": %u, \"accesses\": %u, \"misses\": %u, \"hit_rate\": %.6f, "
+	        "\"miss_rate\": %.6f, ", i->hits, i->accesses, i->accesses - i->hits, rate, 1 - rate);
+	if (error)
+		fprintf(output, "\"error\": %.6f, ", sample_error(i->sample, sim_records(i)));
+	if (i->timing)
+		fprintf(output, "\"hit_latency\": %u, \"dram_latency\": %u, \"mshrs\": %u, "
+		        "\"cycles\": %" PRIu64 ", \"amat\": %.4f, \"mshr_stalls\": %" PRIu64
+		        ", \"merged_misses\": %" PRIu64 ", ", i->timing->params->hit,
+		        i->timing->params->dram, i->timing->params->mshrs, timing_cycles(i->timing),
+		        timing_amat(i), i->timing->stalls, i->timing->merged);
+	if (b)
+		fprintf(output, "\"banks\": %u, \"bank_width\": %u, \"bank_cycles\": %" PRIu64
+		        ", \"bank_conflicts\": %" PRIu64 ", ", b->params->banks, b->params->width,
+		        b->cycles, b->conflicts);
+	if (g_crossings)
+		fprintf(output, "\"line_crossings\": %u, ", g_crossings);
+	fprintf(output, "\"seconds\": %.6f, \"accesses_per_second\": %.0f", i->seconds, speed);
+	print_series_json(output, i->series, intervals);
+}
+
+/* Prints hits,accesses and, when sampled, the half width of the confidence
+   interval of the hit rate */
+static void
+print_stats(FILE *output, const ThreadInfo *i, const char *end)
+{
+	fprintf(output, "%d,%d", i->hits, i->accesses);
+	if (i->sample && !i->sample->weights)
+		fprintf(output, ",%.4f", sample_error(i->sample, sim_records(i)));
+	fprintf(output, "%s", end);
+}
+
+static void
+run_sweep(FILE *output, const struct options *opts)
+{
+	/**
+	 * threads[0] - direct
+	 * threads[1] - set associative
+	 * threads[2] - fully associative
+	 * threads[3] - set associative with write on miss
+	 * threads[4] - set associative with always prefetch
+	 * threads[5] - set associative with prefetch on miss
+	 *
+	 * tlbs[]     - address translation with each page size, with -T
+	 * timings[]  - timing of every cache, with -C
+	 * banks      - banks of the direct-mapped and set associative caches, with -B
+	 * indices[]  - set indexing of every set associative cache, with -I
+	 *
+	 * Job costs are roughly the number of ways searched per access.
+	 */
+	ThreadInfo threads[6][4], translation[PAGE_SIZES];
+	Tlb tlbs[PAGE_SIZES];
+	Timing timings[6 * 4];
+	Banks banks = {&opts->banks};
+	Index indices[6 * 4];
+	Job jobs[6 * 4 + PAGE_SIZES];
+	Fused fused[6 * 4 + PAGE_SIZES];
+	Sample samples[6 * 4 + PAGE_SIZES];
+	ThreadInfo *order[6 * 4 + PAGE_SIZES];
+	unsigned progress[6 * 4 + PAGE_SIZES] = {0}, amt = 0, results = 0;
+	Lockstep lockstep = {0, progress};
+	const bool fuse = opts->fused || opts->lockstep;
+	const unsigned intervals = g_interval && !opts->sample.unit ?
+	                           (g_traces_amt - g_warmup + g_interval - 1) / g_interval : 0;
+	Sample schedule = opts->sample;
+
+	/* Direct */
+	for (int kb = 1, i = 0; kb <= 32; kb *= 2) {
+		if (kb == 2 || kb == 8)
+			continue;
+
+		threads[0][i] = (ThreadInfo) {0, 0, .kb = kb, .ways = 1, .step = sim_set_associative_step};
+		jobs[amt++] = (Job) {sim_set_associative, &threads[0][i++], 1};
+	}
+
+	/* Fully associative */
+	threads[2][0] = (ThreadInfo) {0, 0, .step = sim_fully_associative_step};
+	jobs[amt++] = (Job) {sim_fully_associative, &threads[2][0], 512};
+	threads[2][1] = (ThreadInfo) {0, 0, .step = sim_fully_associative_pseudo_step};
+	jobs[amt++] = (Job) {sim_fully_associative_pseudo, &threads[2][1], 256};
+
+	/* Set associative, plain, with write on miss and with prefetching */
+	for (int asc = 2, i = 0; asc <= 16; asc *= 2, i++) {
+		threads[1][i] = (ThreadInfo) {0, 0, .ways = asc,
+		                              .step = sim_set_associative_step};
+		threads[3][i] = (ThreadInfo) {0, 0, .kb = 16, .ways = asc, .options = OPTION_WRITE_ON_MISS,
+		                              .step = sim_set_associative_step};
+		threads[4][i] = (ThreadInfo) {0, 0, .ways = asc, .options = OPTION_PREFETCH_ALWAYS,
+		                              .step = sim_set_associative_step};
+		threads[5][i] = (ThreadInfo) {0, 0, .ways = asc, .options = OPTION_PREFETCH_ON_MISS,
+		                              .step = sim_set_associative_step};
+
+		jobs[amt++] = (Job) {sim_set_associative, &threads[1][i], asc};
+		jobs[amt++] = (Job) {sim_set_associative, &threads[3][i], asc};
+		jobs[amt++] = (Job) {sim_set_associative, &threads[4][i], 2 * asc};
+		jobs[amt++] = (Job) {sim_set_associative, &threads[5][i], 2 * asc};
+	}
+
+	/* TLBs, sharing the trace pass with the caches when fused */
+	for (int p = 0; opts->tlb.l1_entries && p < PAGE_SIZES; p++) {
+		tlbs[p] = (Tlb) {&opts->tlb, page_shifts[p]};
+		translation[p] = (ThreadInfo) {0, 0, .tlb = &tlbs[p], .step = sim_tlb_step};
+		jobs[amt++] = (Job) {sim_tlb, &translation[p], opts->tlb.l1_ways};
+	}
+
+	/* Configurations with the same number of sets share their indices */
+	for (int x = 0; opts->set_index && !opts->indexing && x < 6; x++)
+		for (int i = 0; x != 2 && i < 4; i++)
+			threads[x][i].set_index = set_index_of(sim_set_associative_mask(&threads[x][i]));
+
+	for (unsigned j = 0; j < amt; j++)
+		((ThreadInfo *) jobs[j].arg)->runs = opts->runs;
+
+	/* Runs rely on the set mask */
+	for (int x = 0, k = 0; opts->indexing && x < 6; x++)
+		for (int i = 0; x != 2 && i < 4; i++, k++) {
+			indices[k] = index_of(opts->indexing, sim_set_associative_mask(&threads[x][i]) + 1);
+			threads[x][i].index = &indices[k];
+			threads[x][i].runs = false;
+		}
+
+	/* Timing needs every access, so it steps over accesses, not runs */
+	for (int x = 0, t = 0; opts->timing.mshrs && x < 6; x++)
+		for (int i = 0; i < (x == 2 ? 2 : 4); i++, t++) {
+			timings[t] = (Timing) {&opts->timing};
+			threads[x][i].timing = &timings[t];
+			threads[x][i].runs = false;
+		}
+
+	for (unsigned j = 0; intervals && j < amt; j++)
+		if (!(((ThreadInfo *) jobs[j].arg)->series = calloc(intervals, sizeof(unsigned))))
+			fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	/* Sampled jobs skip most of the trace, so they are not fused */
+	if (opts->phases)
+		phase_pick(&schedule, opts->phases, opts->runs);
+	else if (schedule.unit)
+		sample_periodic(&schedule, g_traces_amt);
+
+	for (unsigned j = 0; schedule.unit && j < amt; j++) {
+		samples[j] = schedule;
+		((ThreadInfo *) jobs[j].arg)->sample = &samples[j];
+		jobs[j].run = sim_sampled;
+	}
+
+	/* A group per CPU unless -F gives their number (see fuse_jobs) */
+	if (fuse)
+		amt = fuse_jobs(jobs, amt, opts->fused ? opts->fused : pool_cpus(), fused,
+		                (Fused) {.records = sim_fused_records, .step = sim_fused_step,
+		                         .done = sim_fused_done, .block = sim_fused_block(opts->runs),
+		                         .lockstep = opts->lockstep ? &lockstep : NULL});
+
+	pool_run(jobs, amt);
+
+	/* The caches all have 32 byte lines, so they share the banks */
+	if (opts->banks.banks)
+		bank_trace(&banks);
+
+	for (unsigned g = 0; fuse && g < amt; g++)
+		free(fused[g].configs);
+
+	for (int x = 0; x < 6; x++)
+		for (int i = 0; i < (x == 2 ? 2 : 4); i++)
+			order[results++] = &threads[x][i];
+	for (int p = 0; opts->tlb.l1_entries && p < PAGE_SIZES; p++)
+		order[results++] = &translation[p];
+
+	if (opts->format != FORMAT_LEGACY) {
+		if (opts->format == FORMAT_CSV)
+			fprintf(output, "engine,kb,ways,sets,line_bytes,policy,option,index,page_kb,"
+			        "warmup,hits,accesses,misses,hit_rate,miss_rate,error,seconds,"
+			        "accesses_per_second,l2_hits,walks,walk_refs,hit_latency,"
+			        "dram_latency,mshrs,cycles,amat,mshr_stalls,merged_misses,banks,"
+			        "bank_width,bank_cycles,bank_conflicts,line_crossings\n");
+		for (unsigned r = 0; r < results; r++) {
+			print_record(output, opts->format, order[r], opts->banks.banks ? &banks : NULL, intervals);
+			free(order[r]->series);
+		}
+		free(schedule.starts);
+		free(schedule.weights);
+		return;
+	}
+
+	for (int i = 0; i < 4; i++)
+		print_stats(output, &threads[0][i], "; ");
+	fprintf(output, "\n");
+
+	for (int i = 0; i < 4; i++)
+		print_stats(output, &threads[1][i], "; ");
+	fprintf(output, "\n");
+
+	print_stats(output, &threads[2][0], ";\n");
+	print_stats(output, &threads[2][1], ";\n");
+
+	for (int x = 3; x <= 5; x++) {
+		for (int i = 0; i < 4; i++)
+			print_stats(output, &threads[x][i], "; ");
+		fprintf(output, "\n");
+	}
+
+	for (int p = 0; opts->tlb.l1_entries && p < PAGE_SIZES; p++)
+		fprintf(output, "%u,%u,%u; %u,%u;\n", translation[p].hits, tlbs[p].l2_hits,
+		        translation[p].accesses, tlbs[p].walks, tlbs[p].walk_refs);
+
+	/* The timing, a line per cache in the order above */
+	for (int x = 0; opts->timing.mshrs && x < 6; x++)
+		for (int i = 0; i < (x == 2 ? 2 : 4); i++)
+			print_timing(output, &threads[x][i]);
+
+	/* The banks, shared by the direct-mapped and set associative caches */
+	if (opts->banks.banks)
+		fprintf(output, "%" PRIu64 ",%" PRIu64 ";\n", banks.cycles, banks.conflicts);
+
+	if (g_crossings)
+		fprintf(output, "crossings,%u;\n", g_crossings);
+
+	/* The series, a line per configuration in the order above */
+	for (unsigned r = 0; intervals && r < results; r++)
+		print_series(output, &order[r]->series, intervals);
+
+	/* The representative intervals, by their first record, and weights */
+	for (unsigned u = 0; opts->phases && u < schedule.amt; u++)
+		fprintf(output, "%u,%.3f; ", schedule.starts[u], schedule.weights[u]);
+	if (opts->phases)
+		fprintf(output, "\n");
+
+	free(schedule.starts);
+	free(schedule.weights);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	        "Usage: cache-sim [options] input.txt [input2.txt ...] output.txt\n"
+	        "  -m sweep|coherence|shared|reuse|l1\n"
+	        "                         mode (default sweep, needs one input)\n"
+	        "  -f legacy|json|csv     sweep output format, json and csv with a\n"
+	        "                         record per configuration (default legacy)\n"
+	        "  -F GROUPS              fuse the sweep into GROUPS jobs, each\n"
+	        "                         reading the trace once for all its caches\n"
+	        "  -L                     run the fused jobs in lockstep over the trace,\n"
+	        "                         at most one per CPU (the default with -L)\n"
+	        "  -S                     precompute the set of every access once for\n"
+	        "                         each set associative geometry of the sweep\n"
+	        "                         and the shared cache\n"
+	        "  -R                     collapse runs of accesses to the same line\n"
+	        "                         for the sweep, the serial shared cache and\n"
+	        "                         the reuse profile\n"
+	        "  -x WARMUP              warm the caches up on the first WARMUP\n"
+	        "                         accesses, or WARMUP%% of them, uncounted\n"
+	        "                         (no -s, -P, reuse)\n"
+	        "  -t INTERVAL            also write the hits of every sweep result in\n"
+	        "                         each INTERVAL accesses after the warm-up\n"
+	        "                         (no -s, -P, -f csv)\n"
+	        "  -s PERIOD,WARM,UNIT    sample the sweep: every PERIOD accesses, warm\n"
+	        "                         up on WARM and then measure UNIT of them,\n"
+	        "                         adding the 95%% confidence interval of the\n"
+	        "                         hit rate to every result (no -F, -L, -R)\n"
+	        "  -P INTERVAL,PHASES,WARM\n"
+	        "                         simulate the sweep only on a representative\n"
+	        "                         interval of INTERVAL accesses per phase, at\n"
+	        "                         most PHASES, after WARM accesses of warm-up\n"
+	        "                         (no -F, -L, or -R with -I)\n"
+	        "  -T L1,WAYS,L2,WAYS,PWC also simulate L1 and L2 TLBs and a page-walk\n"
+	        "                         cache of PWC entries per level in the sweep,\n"
+	        "                         once with each of 4KB, 2MB and 1GB pages\n"
+	        "  -C HIT,DRAM,MSHRS      time the sweep and shared caches with HIT and\n"
+	        "                         DRAM latencies in cycles and MSHRS misses\n"
+	        "                         outstanding, at most 64 (no -s, -P)\n"
+	        "  -B BANKS,WIDTH         interleave the lines of the set associative\n"
+	        "                         and shared caches over BANKS banks and count\n"
+	        "                         the bank conflicts issuing WIDTH accesses per\n"
+	        "                         cycle, at most 16 (no -s, -P)\n"
+	        "  -r lru|ship|hawkeye    shared cache replacement, SHiP and Hawkeye\n"
+	        "                         predicting from the PCs of the trace\n"
+	        "                         (default lru)\n"
+	        "  -l LINE[,SECTOR]       shared cache lines of LINE bytes, 16 to 256,\n"
+	        "                         in sectors of SECTOR bytes filled on demand\n"
+	        "                         (default 32 bytes, unsectored)\n"
+	        "  -c FILE                write the state of the shared cache to FILE\n"
+	        "                         at the end of the run\n"
+	        "  -e FILE                start the shared cache from the state in\n"
+	        "                         FILE, written by -c with the same geometry\n"
+	        "  -I mod|xor|prime|skew  index the sets of the sweep and shared caches\n"
+	        "                         modulo the sets, XOR folding the tag in,\n"
+	        "                         modulo the largest prime up to the sets, or\n"
+	        "                         skewed with a hash per way; the shared cache\n"
+	        "                         may then have any number of sets\n"
+	        "  -p mesi|moesi          coherence protocol (default mesi)\n"
+	        "  -b snoop|directory     coherence interconnect (default snoop)\n"
+	        "  -i rr|prop|time        interleave inputs round robin, proportionally\n"
+	        "                         to their length or by timestamp (default rr)\n"
+	        "  -q N                   round robin quantum in accesses (default 1)\n"
+	        "  -k KB -w WAYS          private or shared cache geometry\n"
+	        "                         (default 16KB, 4-way)\n"
+	        "  -o none|wom|pfa|pfm    shared cache and L1 write-on-miss, prefetch\n"
+	        "                         always or prefetch on miss (default none)\n"
+	        "  -j THREADS             simulate the shared cache on THREADS threads,\n"
+	        "                         each with a range of its sets\n"
+	        "  -W MASK,MASK,...       ways each shared cache tenant may fill\n"
+	        "  -u EPOCH               repartition the ways between tenants with\n"
+	        "                         UCP every EPOCH accesses\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	FILE *output;
+	struct options opts = {.mode = MODE_SWEEP, .kb = 16, .ways = 4, .quantum = 1, .threads = 1};
+	Traces streams[MAX_STREAMS];
+	unsigned amts[MAX_STREAMS], n, line_log;
+	char *mask;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:p:b:i:q:k:w:W:u:o:j:F:T:C:B:I:l:r:c:e:s:P:x:t:f:LSR")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "sweep"))
+				opts.mode = MODE_SWEEP;
+			else if (!strcmp(optarg, "coherence"))
+				opts.mode = MODE_COHERENCE;
+			else if (!strcmp(optarg, "shared"))
+				opts.mode = MODE_SHARED;
+			else if (!strcmp(optarg, "reuse"))
+				opts.mode = MODE_REUSE;
+			else if (!strcmp(optarg, "l1"))
+				opts.mode = MODE_L1;
+			else
+				usage();
+			break;
+		case 'p':
+			opts.moesi = !strcmp(optarg, "moesi");
+			if (!opts.moesi && strcmp(optarg, "mesi"))
+				usage();
+			break;
+		case 'b':
+			opts.directory = !strcmp(optarg, "directory");
+			if (!opts.directory && strcmp(optarg, "snoop"))
+				usage();
+			break;
+		case 'i':
+			if (!strcmp(optarg, "rr"))
+				opts.interleave = INTERLEAVE_ROUND_ROBIN;
+			else if (!strcmp(optarg, "prop"))
+				opts.interleave = INTERLEAVE_PROPORTIONAL;
+			else if (!strcmp(optarg, "time"))
+				opts.interleave = INTERLEAVE_TIME;
+			else
+				usage();
+			break;
+		case 'q':
+			if (atoi(optarg) < 1)
+				fprintf(stderr, "Invalid quantum %s for -q.\n", optarg), exit(1);
+			opts.quantum = atoi(optarg);
+			break;
+		case 'k':
+			if (atoi(optarg) < 1)
+				fprintf(stderr, "Invalid cache size %s for -k.\n", optarg), exit(1);
+			opts.kb = atoi(optarg);
+			break;
+		case 'w':
+			if (atoi(optarg) < 1)
+				fprintf(stderr, "Invalid associativity %s for -w.\n", optarg), exit(1);
+			opts.ways = atoi(optarg);
+			break;
+		case 'W':
+			for (mask = strtok(optarg, ","); mask; mask = strtok(NULL, ",")) {
+				if (opts.way_masks_amt == MAX_STREAMS)
+					fprintf(stderr, "-W has more masks than inputs.\n"), exit(1);
+				opts.way_masks[opts.way_masks_amt++] = strtoul(mask, NULL, 0);
+			}
+			break;
+		case 'u':
+			if (atoi(optarg) < 1)
+				fprintf(stderr, "Invalid epoch %s for -u.\n", optarg), exit(1);
+			opts.epoch = atoi(optarg);
+			break;
+		case 'o':
+			if (!strcmp(optarg, "none"))
+				opts.option = OPTION_NONE;
+			else if (!strcmp(optarg, "wom"))
+				opts.option = OPTION_WRITE_ON_MISS;
+			else if (!strcmp(optarg, "pfa"))
+				opts.option = OPTION_PREFETCH_ALWAYS;
+			else if (!strcmp(optarg, "pfm"))
+				opts.option = OPTION_PREFETCH_ON_MISS;
+			else
+				usage();
+			break;
+		case 'j':
+			if (atoi(optarg) < 1)
+				fprintf(stderr, "Invalid thread count %s for -j.\n", optarg), exit(1);
+			opts.threads = atoi(optarg);
+			break;
+		case 'F':
+			if (atoi(optarg) < 1)
+				fprintf(stderr, "Invalid group count %s for -F.\n", optarg), exit(1);
+			opts.fused = atoi(optarg);
+			break;
+		case 'L':
+			opts.lockstep = true;
+			break;
+		case 'S':
+			opts.set_index = true;
+			break;
+		case 'R':
+			opts.runs = true;
+			break;
+		case 's':
+			if (sscanf(optarg, "%u,%u,%u", &opts.sample.period, &opts.sample.warm,
+			           &opts.sample.unit) != 3 || !opts.sample.unit ||
+			    opts.sample.period < opts.sample.warm + opts.sample.unit)
+				usage();
+			break;
+		case 'x':
+			if (!warmup_valid(optarg))
+				fprintf(stderr, "Invalid warm-up %s for -x.\n", optarg), exit(1);
+			opts.warmup = optarg;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "legacy"))
+				opts.format = FORMAT_LEGACY;
+			else if (!strcmp(optarg, "json"))
+				opts.format = FORMAT_JSON;
+			else if (!strcmp(optarg, "csv"))
+				opts.format = FORMAT_CSV;
+			else
+				usage();
+			break;
+		case 't':
+			if (atoi(optarg) < 1)
+				fprintf(stderr, "Invalid interval %s for -t.\n", optarg), exit(1);
+			g_interval = atoi(optarg);
+			break;
+		case 'P':
+			if (sscanf(optarg, "%u,%u,%u", &opts.sample.unit, &opts.phases,
+			           &opts.sample.warm) != 3 || !opts.sample.unit ||
+			    opts.phases < 1 || opts.phases > MAX_PHASES)
+				usage();
+			break;
+		case 'T':
+			if (sscanf(optarg, "%u,%u,%u,%u,%u", &opts.tlb.l1_entries, &opts.tlb.l1_ways,
+			           &opts.tlb.l2_entries, &opts.tlb.l2_ways, &opts.tlb.pwc) != 5)
+				usage();
+			break;
+		case 'C':
+			if (sscanf(optarg, "%u,%u,%u", &opts.timing.hit, &opts.timing.dram,
+			           &opts.timing.mshrs) != 3 || opts.timing.mshrs < 1 ||
+			    opts.timing.mshrs > MAX_MSHRS)
+				usage();
+			break;
+		case 'I':
+			if (!strcmp(optarg, "mod"))
+				opts.indexing = INDEX_MODULO;
+			else if (!strcmp(optarg, "xor"))
+				opts.indexing = INDEX_XOR;
+			else if (!strcmp(optarg, "prime"))
+				opts.indexing = INDEX_PRIME;
+			else if (!strcmp(optarg, "skew"))
+				opts.indexing = INDEX_SKEW;
+			else
+				usage();
+			break;
+		case 'r':
+			if (!strcmp(optarg, "lru"))
+				opts.policy = POLICY_LRU;
+			else if (!strcmp(optarg, "ship"))
+				opts.policy = POLICY_SHIP;
+			else if (!strcmp(optarg, "hawkeye"))
+				opts.policy = POLICY_HAWKEYE;
+			else
+				usage();
+			break;
+		case 'c':
+			opts.checkpoint = optarg;
+			break;
+		case 'e':
+			opts.resume = optarg;
+			break;
+		case 'l':
+			opts.sector_bytes = 0;
+			if (sscanf(optarg, "%u,%u", &opts.line_bytes, &opts.sector_bytes) < 1)
+				usage();
+			if (!opts.sector_bytes)
+				opts.sector_bytes = opts.line_bytes;
+			break;
+		case 'B':
+			if (sscanf(optarg, "%u,%u", &opts.banks.banks, &opts.banks.width) != 2 ||
+			    opts.banks.banks < 1 || opts.banks.width < 1 || opts.banks.width > MAX_ISSUE)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+
+	n = argc - optind - 1;
+	if (argc - optind < 2 || n > MAX_STREAMS || (opts.mode == MODE_SWEEP && n != 1))
+		usage();
+
+	/* Only the shared cache may have any number of sets, with -I */
+	unsigned sets = opts.kb * 1024 / ((opts.line_bytes ? opts.line_bytes : 32) * opts.ways);
+	if (opts.ways < 1 || opts.ways > 16 || sets < 1 ||
+	    ((sets & (sets - 1)) && (!opts.indexing || opts.mode != MODE_SHARED)))
+		fprintf(stderr, "Invalid cache geometry.\n"), exit(1);
+
+	if (opts.way_masks_amt > n)
+		fprintf(stderr, "-W has more masks than inputs.\n"), exit(1);
+
+	for (unsigned t = 0; t < opts.way_masks_amt; t++)
+		if (!opts.way_masks[t] || opts.way_masks[t] >> opts.ways)
+			fprintf(stderr, "Invalid way mask %#x.\n", opts.way_masks[t]), exit(1);
+
+	/* Only the sweep has these, the other modes would ignore them */
+	if (opts.mode != MODE_SWEEP && (opts.tlb.l1_entries || opts.sample.period || opts.phases ||
+	    g_interval || opts.format != FORMAT_LEGACY || opts.fused || opts.lockstep))
+		fprintf(stderr, "-T, -s, -P, -t, -f, -F and -L are for the sweep only.\n"), exit(1);
+
+	if (opts.mode != MODE_SWEEP && opts.mode != MODE_SHARED &&
+	    (opts.timing.mshrs || opts.banks.banks || opts.indexing || opts.set_index))
+		fprintf(stderr, "-C, -B, -I and -S are for the sweep and the shared cache only.\n"), exit(1);
+
+	if (opts.mode != MODE_SHARED && (opts.way_masks_amt || opts.epoch || opts.line_bytes || opts.policy ||
+	    opts.threads > 1))
+		fprintf(stderr, "-W, -u, -l, -r and -j are for the shared cache only.\n"), exit(1);
+
+	if ((opts.mode == MODE_COHERENCE || opts.mode == MODE_L1) && opts.runs)
+		fprintf(stderr, "-R is for the sweep, the shared cache and the reuse profile only.\n"), exit(1);
+
+	if (opts.mode != MODE_SHARED && opts.mode != MODE_L1 && opts.option)
+		fprintf(stderr, "-o is for the shared cache and the L1s only.\n"), exit(1);
+
+	if (opts.mode == MODE_REUSE && opts.warmup)
+		fprintf(stderr, "-x is not for the reuse profile.\n"), exit(1);
+
+	/* Sampled sweeps skip most of the trace, so they are never fused */
+	if (opts.sample.unit && (opts.fused || opts.lockstep))
+		fprintf(stderr, "-s and -P take no -F or -L.\n"), exit(1);
+
+	/* Indexed caches step over accesses, the intervals of -P -R are runs */
+	if (opts.phases && opts.runs && opts.indexing)
+		fprintf(stderr, "-P takes no -R with -I.\n"), exit(1);
+
+	if ((opts.phases && opts.sample.period) || (opts.runs && opts.sample.period) ||
+	    (g_interval && opts.format == FORMAT_CSV) ||
+	    ((opts.timing.mshrs || opts.banks.banks || opts.warmup || g_interval) && opts.sample.unit))
+		usage();
+
+	if (opts.line_bytes && (opts.line_bytes & (opts.line_bytes - 1) ||
+	    opts.sector_bytes & (opts.sector_bytes - 1) ||
+	    opts.sector_bytes < 1u << MIN_LINE_LOG || opts.line_bytes > 1u << MAX_LINE_LOG ||
+	    opts.sector_bytes > opts.line_bytes))
+		fprintf(stderr, "Invalid line or sector size.\n"), exit(1);
+
+	if (opts.line_bytes && (opts.option || opts.epoch))
+		fprintf(stderr, "Sectored caches take no -o or -u.\n"), exit(1);
+
+	if (opts.policy && (opts.line_bytes || opts.indexing == INDEX_SKEW ||
+	    (opts.option && opts.option != OPTION_WRITE_ON_MISS) || opts.epoch))
+		fprintf(stderr, "SHiP and Hawkeye take no -l, -I skew, -o pfa|pfm or -u.\n"), exit(1);
+
+	if ((opts.checkpoint || opts.resume) && (opts.mode != MODE_SHARED || opts.epoch))
+		fprintf(stderr, "Checkpoints are of the shared cache, without -u.\n"), exit(1);
+
+	if (opts.tlb.l1_entries && !tlb_geometry_valid(&opts.tlb))
+		fprintf(stderr, "Invalid TLB geometry.\n"), exit(1);
+
+	/* The monitors keep an LRU stack per set, which skewed caches have not */
+	if (opts.epoch && opts.indexing == INDEX_SKEW)
+		fprintf(stderr, "UCP takes no -I skew.\n"), exit(1);
+
+	if (opts.epoch && n > opts.ways)
+		fprintf(stderr, "UCP needs at least one way per tenant.\n"), exit(1);
+
+	if (!(output = fopen(argv[argc - 1], "w")))
+		fprintf(stderr, "Failed to open files.\n"), exit(1);
+
+	/* Read traces into g_traces, split at the lines simulated */
+	line_log = opts.line_bytes ? mylog2(opts.line_bytes) : block_id_offset;
+	if (n == 1) {
+		g_traces = read_trace(argv[optind], &g_traces_amt, line_log);
+		g_streams = calloc(g_traces_amt, 1);
+	} else {
+		for (unsigned s = 0; s < n; s++) {
+			streams[s] = read_trace(argv[optind + s], &amts[s], line_log);
+			if (opts.interleave == INTERLEAVE_TIME && amts[s] && !streams[s].times)
+				fprintf(stderr, "Interleaving by time needs timestamps in every input.\n"), exit(1);
+		}
+		interleave_traces(streams, amts, n, opts.interleave, opts.quantum);
+		for (unsigned s = 0; s < n; s++)
+			traces_free(&streams[s]);
+	}
+
+	if (opts.policy && opts.mode == MODE_SHARED && !g_traces.pcs)
+		fprintf(stderr, "SHiP and Hawkeye need the PCs of the extended trace format.\n"), exit(1);
+
+	if (opts.warmup)
+		g_warmup = warmup_of(opts.warmup, g_traces_amt);
+
+	if (opts.runs)
+		collapse_runs();
+
+	if (opts.mode == MODE_COHERENCE)
+		run_coherence(output, &opts, n);
+	else if (opts.mode == MODE_SHARED)
+		run_shared(output, &opts, n);
+	else if (opts.mode == MODE_REUSE)
+		run_reuse(output, &opts);
+	else if (opts.mode == MODE_L1)
+		run_l1(output, &opts);
+	else
+		run_sweep(output, &opts);
 
+	for (unsigned g = 0; g < g_set_index_amt; g++)
+		free(g_set_index[g].index);
+	free(g_runs);
+	traces_free(&g_traces);
+	free(g_streams);
 	fclose(output);
 	return 0;
 }
@@ -0,0 +1,304 @@
+/* Copyright 2021 Fotis Antonatos. See LICENSE */
+
+/*
+ * Parallel runs shared by cache-sim and predictors: the thread pool, fused
+ * jobs, and the wall time of their configurations. Each tool includes this
+ * header once, so everything in it is static.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdlib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Work-stealing thread pool.
+ *
+ * pool_run() runs independent jobs on one worker per online CPU. The jobs
+ * are dealt out longest first, every worker runs its own jobs longest
+ * first, and a worker that runs dry steals from the others. Results are
+ * left in the job arguments, so callers print them in a fixed order once
+ * pool_run returns.
+ */
+
+/* run, arg  the job, as for pthread_create()
+ * cost      relative run time, longer jobs start first
+ */
+typedef struct {
+	void *(*run)(void *);
+	void *arg;
+	unsigned cost;
+} Job;
+
+typedef struct {
+	Job **jobs; /* Longest first from head */
+	unsigned head, tail;
+	pthread_mutex_t lock;
+} Deque;
+
+typedef struct {
+	Deque *deques;
+	unsigned workers;
+} Pool;
+
+typedef struct {
+	Pool *pool;
+	unsigned id;
+} PoolWorker;
+
+static Job *
+pool_take(Deque *d)
+{
+	Job *job = NULL;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->head != d->tail)
+		job = d->jobs[d->head++];
+	pthread_mutex_unlock(&d->lock);
+
+	return job;
+}
+
+static void *
+pool_worker(void *arg)
+{
+	PoolWorker *pw = arg;
+	Pool *pool = pw->pool;
+
+	for (;;) {
+		Job *job = pool_take(&pool->deques[pw->id]);
+
+		for (unsigned v = 1; !job && v < pool->workers; v++)
+			job = pool_take(&pool->deques[(pw->id + v) % pool->workers]);
+
+		/* Nothing left to steal, and no job is ever added */
+		if (!job)
+			return NULL;
+
+		job->run(job->arg);
+	}
+}
+
+static int
+job_longest_first(const void *a, const void *b)
+{
+	const Job *x = a, *y = b;
+
+	return (x->cost < y->cost) - (x->cost > y->cost);
+}
+
+static int
+pool_longest_first(const void *a, const void *b)
+{
+	return job_longest_first(*(Job * const *) a, *(Job * const *) b);
+}
+
+static unsigned
+pool_cpus(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return cpus < 1 ? 1 : cpus;
+}
+
+static void
+pool_run(Job *jobs, unsigned amt)
+{
+	unsigned cpus = pool_cpus();
+	Pool pool = {0};
+	Job **ready = malloc(amt * sizeof(Job *));
+
+	pool.workers = cpus < amt ? cpus : amt ? amt : 1;
+	pool.deques = calloc(pool.workers, sizeof(Deque));
+	PoolWorker *pw = calloc(pool.workers, sizeof(PoolWorker));
+	pthread_t *threads = calloc(pool.workers, sizeof(pthread_t));
+
+	if (!ready || !pool.deques || !pw || !threads)
+		fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	for (unsigned j = 0; j < amt; j++)
+		ready[j] = &jobs[j];
+	qsort(ready, amt, sizeof(Job *), pool_longest_first);
+
+	/* Every deque gets its share of the jobs, dealt out longest first */
+	for (unsigned w = 0; w < pool.workers; w++) {
+		Deque *d = &pool.deques[w];
+
+		if (!(d->jobs = malloc((amt / pool.workers + 1) * sizeof(Job *))))
+			fprintf(stderr, "Out of memory.\n"), exit(1);
+		pthread_mutex_init(&d->lock, NULL);
+	}
+	for (unsigned r = 0; r < amt; r++) {
+		Deque *d = &pool.deques[r % pool.workers];
+		d->jobs[d->tail++] = ready[r];
+	}
+
+	for (unsigned w = 0; w < pool.workers; w++) {
+		pw[w] = (PoolWorker) {&pool, w};
+		(void) pthread_create(&threads[w], NULL, pool_worker, (void *) &pw[w]);
+	}
+
+	for (unsigned w = 0; w < pool.workers; w++)
+		(void) pthread_join(threads[w], NULL);
+
+	for (unsigned w = 0; w < pool.workers; w++) {
+		pthread_mutex_destroy(&pool.deques[w].lock);
+		free(pool.deques[w].jobs);
+	}
+
+	free(threads);
+	free(pw);
+	free(pool.deques);
+	free(ready);
+}
+
+/*
+ * Fused jobs.
+ *
+ * A configuration streaming the whole trace on its own reads the trace from
+ * memory once per configuration. A fused job instead walks the trace in
+ * blocks small enough to stay in the L2 cache, and advances each of its
+ * configurations over a block before moving on to the next.
+ *
+ * Fused jobs running at the same time still each read the trace on their
+ * own. In lockstep, every job publishes the number of blocks it finished
+ * and waits before a block until all the others are at most LOCKSTEP_SLACK
+ * blocks behind. A block is then read from memory once and consumed by
+ * every job while it is still in the shared last level cache. All parties
+ * must be running at once, so there are never more than pool_cpus().
+ */
+#define LOCKSTEP_SLACK 2
+
+typedef struct {
+	unsigned parties;
+	unsigned *progress;
+} Lockstep;
+
+static void
+lockstep_wait(Lockstep *l, unsigned block)
+{
+	for (unsigned p = 0; p < l->parties; p++)
+		while (__atomic_load_n(&l->progress[p], __ATOMIC_ACQUIRE) + LOCKSTEP_SLACK < block)
+			sched_yield();
+}
+
+static void
+lockstep_done(Lockstep *l, unsigned party, unsigned blocks)
+{
+	__atomic_store_n(&l->progress[party], blocks, __ATOMIC_RELEASE);
+}
+
+/* configs   configurations of the tool, each stepping over its own records
+ * records   number of records a configuration steps over
+ * step      advances a configuration over records [begin, end)
+ * done      releases a configuration after its last step, or NULL
+ * block     records per block
+ * lockstep  parties to keep pace with, or NULL
+ * party     this job's slot in lockstep->progress
+ */
+typedef struct {
+	void **configs;
+	unsigned amt, cost;
+	unsigned (*records)(void *config);
+	void (*step)(void *config, unsigned begin, unsigned end);
+	void (*done)(void *config);
+	unsigned block;
+	Lockstep *lockstep;
+	unsigned party;
+} Fused;
+
+static void *
+fused_run(void *arg)
+{
+	Fused *f = arg;
+	unsigned records = 0;
+
+	for (unsigned c = 0; c < f->amt; c++)
+		if (f->records(f->configs[c]) > records)
+			records = f->records(f->configs[c]);
+
+	for (unsigned begin = 0, block = 0; begin < records; begin += f->block, block++) {
+		const unsigned end = records - begin < f->block ? records : begin + f->block;
+
+		if (f->lockstep)
+			lockstep_wait(f->lockstep, block);
+
+		for (unsigned c = 0; c < f->amt; c++) {
+			const unsigned own = f->records(f->configs[c]);
+
+			if (begin < own)
+				f->step(f->configs[c], begin, end < own ? end : own);
+		}
+
+		if (f->lockstep)
+			lockstep_done(f->lockstep, f->party, block + 1);
+	}
+
+	/* Finished parties never hold the others back */
+	if (f->lockstep)
+		lockstep_done(f->lockstep, f->party, UINT_MAX - LOCKSTEP_SLACK);
+
+	for (unsigned c = 0; f->done && c < f->amt; c++)
+		f->done(f->configs[c]);
+
+	return NULL;
+}
+
+/* Replaces jobs over configurations with at most groups fused jobs like
+   proto, balancing their cost by handing out the longest job first to the
+   cheapest group. The groups keep pace with each other when proto has a
+   lockstep, which must have room for them. Returns the number of jobs. */
+static unsigned
+fuse_jobs(Job *jobs, unsigned amt, unsigned groups, Fused *fused, Fused proto)
+{
+	qsort(jobs, amt, sizeof(Job), job_longest_first);
+
+	if (groups > amt)
+		groups = amt;
+
+	if (proto.lockstep) {
+		if (groups > pool_cpus())
+			groups = pool_cpus();
+		proto.lockstep->parties = groups;
+	}
+
+	for (unsigned g = 0; g < groups; g++) {
+		fused[g] = proto;
+		fused[g].party = g;
+		if (!(fused[g].configs = malloc(amt * sizeof(void *))))
+			fprintf(stderr, "Out of memory.\n"), exit(1);
+	}
+
+	for (unsigned j = 0; j < amt; j++) {
+		Fused *cheapest = &fused[0];
+
+		for (unsigned g = 1; g < groups; g++)
+			if (fused[g].cost < cheapest->cost)
+				cheapest = &fused[g];
+
+		cheapest->configs[cheapest->amt++] = jobs[j].arg;
+		cheapest->cost += jobs[j].cost;
+	}
+
+	for (unsigned g = 0; g < groups; g++)
+		jobs[g] = (Job) {fused_run, &fused[g], fused[g].cost};
+
+	return groups;
+}
+
+static double
+now_seconds(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+#endif /* POOL_H */
@@ -0,0 +1,192 @@
+/* Copyright 2021 Fotis Antonatos. See LICENSE */
+
+/*
+ * Simulation helpers shared by cache-sim and predictors: the warm-up, stepping
+ * over the trace with it and a series, structured output and checkpoints.
+ * Each tool includes this header once, so everything in it is static.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+/* Whether arg is a warm-up: a number, or a percentage ending in % */
+static int
+warmup_valid(const char *arg)
+{
+	char *end;
+
+	strtod(arg, &end);
+	return end != arg && (!*end || (*end == '%' && !end[1]));
+}
+
+/* A warm-up of a number of records, or a percentage of them ending in % */
+static unsigned
+warmup_of(const char *arg, unsigned records)
+{
+	char *end;
+	double n = strtod(arg, &end);
+
+	if (*end == '%')
+		n = n * records / 100;
+
+	return n <= 0 ? 0 : n < records ? n : records;
+}
+
+/* Steps of a simulation (see steps_run)
+ *
+ * sim        the simulation stepped, passed to the callbacks
+ * step       advances it over records [begin, end)
+ * reset      drops its counts, at the end of the warm-up
+ * count      its counts so far, recorded in the series
+ * access_of  first access of a record
+ * record_of  first record at or after an access, or the records at the end
+ * warm       records of the warm-up
+ * warmup     accesses of the warm-up
+ * interval   accesses per interval of the series
+ * series     counts at the end of every interval, or NULL
+ * seconds    wall time spent stepping, added to
+ */
+typedef struct {
+	void *sim;
+	void (*step)(void *sim, unsigned begin, unsigned end);
+	void (*reset)(void *sim);
+	unsigned (*count)(void *sim);
+	uint64_t (*access_of)(void *sim, unsigned record);
+	unsigned (*record_of)(void *sim, uint64_t access);
+	unsigned warm, warmup, interval;
+	unsigned *series;
+	double *seconds;
+} Steps;
+
+/* Steps the simulation over records [begin, end), dropping its counts at
+   the end of the warm-up. With a series, the steps also stop at every
+   interval after the warm-up to record the counts so far, which leaves the
+   simulation without any per access cost. */
+static void
+steps_run(const Steps *s, unsigned begin, unsigned end)
+{
+	const double start = now_seconds();
+
+	if (begin < s->warm && s->warm <= end) {
+		s->step(s->sim, begin, s->warm);
+		s->reset(s->sim);
+		begin = s->warm;
+	}
+
+	while (s->series && begin >= s->warm && begin < end) {
+		const unsigned k = (s->access_of(s->sim, begin) - s->warmup) / s->interval;
+		const unsigned next = s->record_of(s->sim, s->warmup + (uint64_t) (k + 1) * s->interval);
+
+		if (next > end)
+			break;
+		s->step(s->sim, begin, next);
+		s->series[k] = s->count(s->sim);
+		begin = next;
+	}
+
+	if (begin < end)
+		s->step(s->sim, begin, end);
+	*s->seconds += now_seconds() - start;
+}
+
+/* Prints the counts in every interval of the series, then frees it */
+static void
+print_series(FILE *output, unsigned **series, unsigned intervals)
+{
+	for (unsigned k = 0; k < intervals; k++)
+		fprintf(output, "%u%s", (*series)[k] - (k ? (*series)[k - 1] : 0),
+		        k + 1 < intervals ? "," : ";\n");
+	free(*series);
+	*series = NULL;
+}
+
+/*
+ * Structured output.
+ *
+ * With -f json or -f csv every result is a record of its own, carrying the
+ * configuration it was simulated with, so that readers do not depend on the
+ * legacy order. JSON has an object per line, CSV a header.
+ */
+enum format {FORMAT_LEGACY, FORMAT_JSON, FORMAT_CSV};
+
+/* Prints the series of a JSON record as its last field, if there is one */
+static void
+print_series_json(FILE *output, const unsigned *series, unsigned intervals)
+{
+	for (unsigned k = 0; series && k < intervals; k++)
+		fprintf(output, "%s%u", k ? ", " : ", \"series\": [",
+		        series[k] - (k ? series[k - 1] : 0));
+	fprintf(output, "%s}\n", series && intervals ? "]" : "");
+}
+
+/*
+ * Checkpoints.
+ *
+ * With -c the state of a run is written to a file once it is over, and with
+ * -e a run starts from such a file instead of from a cold state, so state
+ * warmed up once on a long prefix of a trace can carry on over any number
+ * of other traces. The file holds a magic string, a header describing what
+ * was simulated, which the run resuming must match, and then the state, in
+ * the byte order of the machine.
+ */
+#define CHECKPOINT_HEADER 8 /* Fields of a header, at most */
+
+typedef struct {
+	FILE *file;
+	const char *path;
+	bool write;
+} Checkpoint;
+
+/* Writes or reads size bytes at data */
+static void
+checkpoint_field(Checkpoint *c, void *data, size_t size)
+{
+	if (size && (c->write ? fwrite(data, size, 1, c->file) : fread(data, size, 1, c->file)) != 1)
+		fprintf(stderr, "Failed to %s checkpoint %s.\n", c->write ? "write" : "read", c->path),
+		exit(1);
+}
+
+/* Opens a checkpoint and writes, or reads and checks, its magic and the
+   header of amt fields, failing with what a mismatch means and the first
+   of the names of the fields that differs otherwise */
+static Checkpoint
+checkpoint_open(const char *path, bool write, const char *magic, const uint64_t *header,
+                const char *const *names, unsigned amt, const char *mismatch)
+{
+	Checkpoint c = {fopen(path, write ? "wb" : "rb"), path, write};
+	char stored_magic[8];
+	uint64_t stored[CHECKPOINT_HEADER];
+
+	if (!c.file)
+		fprintf(stderr, "Failed to open checkpoint %s.\n", path), exit(1);
+
+	memcpy(stored_magic, magic, sizeof(stored_magic));
+	memcpy(stored, header, amt * sizeof(header[0]));
+	checkpoint_field(&c, stored_magic, sizeof(stored_magic));
+	checkpoint_field(&c, stored, amt * sizeof(header[0]));
+	if (!write && memcmp(stored_magic, magic, sizeof(stored_magic)))
+		fprintf(stderr, "Checkpoint %s %s.\n", path, mismatch), exit(1);
+	for (unsigned f = 0; !write && f < amt; f++)
+		if (stored[f] != header[f])
+			fprintf(stderr, "Checkpoint %s %s: %s %llu, not %llu.\n", path, mismatch, names[f],
+			        (unsigned long long) stored[f], (unsigned long long) header[f]), exit(1);
+
+	return c;
+}
+
+static void
+checkpoint_close(Checkpoint *c)
+{
+	if (fclose(c->file))
+		fprintf(stderr, "Failed to close checkpoint %s.\n", c->path), exit(1);
+}
+
+#endif /* SIM_H */
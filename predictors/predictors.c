@@ -13,7 +13,7 @@
  * Branch Target Buffer (using single-bit bimodal) is also tested.
  * 
  * main() reads the tracefile (provided via command-line args) and calls the predictors.
- * Predictors run on their own threads.
+ * Predictors run as jobs on a work-stealing thread pool sized to the machine.
  */
 
 #include <stdlib.h>
@@ -22,6 +22,9 @@
 #include <stdbool.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+
+#include "sim.h"
 
 #define STRONG_NO            0b00
 #define WEAK_NO              0b01
@@ -37,8 +40,12 @@
  * always_val    indicates to sim_always whether to always take the branch
  * table_size    specifies the branch prediction table size
  * history_size  specifies the global history register's number of bits
+ * series        correct predictions at the end of every interval, or NULL
+ * seconds       wall time spent stepping
+ * step          advances the predictor over branches [begin, end)
+ * tables        the predictor's state between steps
  */
-typedef struct {
+typedef struct tparams {
 	unsigned correct, attempted;
 	union
 	{
@@ -46,6 +53,10 @@ typedef struct {
 		int table_size;
 		int history_size;
 	};
+	unsigned *series;
+	double seconds;
+	void (*step)(struct tparams *, unsigned begin, unsigned end);
+	struct tables *tables;
 } TParams;
 
 /* addr    the branch instruction's address
@@ -59,36 +70,66 @@ struct pair {
 
 struct pair *g_traces = NULL;
 unsigned     g_traces_count = 0;
+unsigned     g_warmup = 0; /* Branches that train the predictors uncounted */
+unsigned     g_interval = 0; /* Branches per interval of the series, or 0 */
+
+/* Predictor tables, kept between steps
+ *
+ * ghr       global history register
+ * pht       single-bit or two-bit bimodal, gshare (also the tournament's)
+ *           and the BTB's single-bit bimodal
+ * bimodal   the tournament's bimodal
+ * selector  the tournament's chooser
+ */
+struct tables {
+	unsigned      ghr;
+	unsigned char pht[2048], bimodal[2048], selector[2048];
+	uint64_t      btb[512];
+};
 
-void *
-sim_always(void *arg)
+/* Returns the predictor's tables, with pht initially set to init */
+static struct tables *
+tables_of(TParams *p, unsigned char init)
+{
+	struct tables *t = p->tables;
+
+	if (!t) {
+		if (!(t = p->tables = malloc(sizeof(struct tables))))
+			fprintf(stderr, "Out of memory.\n"), exit(1);
+
+		t->ghr = 0;
+		(void) memset(&t->pht, init, sizeof(t->pht));
+		(void) memset(&t->bimodal, STRONG_YES, sizeof(t->bimodal));
+		(void) memset(&t->selector, PREFER_GSHARE, sizeof(t->selector));
+		(void) memset(&t->btb, 0, sizeof(t->btb));
+	}
+
+	return t;
+}
+
+void
+sim_always(TParams *p, unsigned begin, unsigned end)
 {
-	TParams *p = arg;
 	bool always_val = p->always_val;
 
 	unsigned correct = 0;
 
-	for (int i = 0; i < g_traces_count; i++) {
+	for (unsigned i = begin; i < end; i++) {
 		struct pair branch = g_traces[i];
 		if (branch.actual == always_val) correct++;
 	}
 
-	p->correct = correct;
-	return NULL;
+	p->correct += correct;
 }
 
-void *
-sim_bimodal_one(void *arg) 
+void
+sim_bimodal_one(TParams *p, unsigned begin, unsigned end)
 {
-	TParams *p = arg;
 	int table_size = p->table_size;
-	bool hist[table_size];
+	unsigned char *hist = tables_of(p, true)->pht;
 	unsigned index, correct = 0;
 
-	/* Only allowed on arrays of bytes! */
-	(void) memset(&hist, true, table_size);
-
-	for (int i = 0; i < g_traces_count; i++) {
+	for (unsigned i = begin; i < end; i++) {
 		struct pair branch = g_traces[i];
 		index = branch.addr % table_size;
 
@@ -96,21 +137,17 @@ sim_bimodal_one(void *arg)
 		hist[index] = branch.actual;
 	}
 
-	p->correct = correct;
-	return NULL;
+	p->correct += correct;
 }
 
-void *
-sim_bimodal_two(void *arg)
+void
+sim_bimodal_two(TParams *p, unsigned begin, unsigned end)
 {
-	TParams *p = arg;
 	int table_size = p->table_size;
-	unsigned char hist[table_size]; /* Initial configuration: Strong Yes */
+	unsigned char *hist = tables_of(p, STRONG_YES)->pht; /* Initial configuration: Strong Yes */
 	unsigned index, correct = 0;
 
-	(void) memset(&hist, STRONG_YES, table_size);
-
-	for (int i = 0; i < g_traces_count; i++) {
+	for (unsigned i = begin; i < end; i++) {
 		struct pair branch = g_traces[i];
 		index = branch.addr % table_size;
 
@@ -120,21 +157,18 @@ sim_bimodal_two(void *arg)
 		else if (!branch.actual && hist[index] >= WEAK_NO) hist[index]--;
 	}
 
-	p->correct = correct;
-	return NULL;
+	p->correct += correct;
 }
 
-void *
-sim_gshare(void *arg)
+void
+sim_gshare(TParams *p, unsigned begin, unsigned end)
 {
-	TParams *p = arg;
 	int history_size = p->history_size;
-	unsigned char hist[2048];
-	unsigned index, correct = 0, ghr = 0;
-	
-	(void) memset(&hist, STRONG_YES, 2048);
+	struct tables *t = tables_of(p, STRONG_YES);
+	unsigned char *hist = t->pht;
+	unsigned index, correct = 0, ghr = t->ghr;
 
-	for (int i = 0; i < g_traces_count; i++) {
+	for (unsigned i = begin; i < end; i++) {
 		struct pair branch = g_traces[i];
 		index = (branch.addr % 2048) ^ ghr;
 
@@ -146,24 +180,20 @@ sim_gshare(void *arg)
 		ghr = ((ghr << 1) + branch.actual) & ~(0xFFFF << history_size);
 	}
 
-	p->correct = correct;
-	return NULL;
+	t->ghr = ghr;
+	p->correct += correct;
 }
 
-void *
-sim_tournament(void *arg)
+void
+sim_tournament(TParams *p, unsigned begin, unsigned end)
 {
-	TParams *p = arg;
-	unsigned char gshare[2048], bimodal[2048], selector[2048];
-	unsigned g, b, correct = 0, ghr = 0, history_size = 11;
+	struct tables *t = tables_of(p, STRONG_YES);
+	unsigned char *gshare = t->pht, *bimodal = t->bimodal, *selector = t->selector;
+	unsigned g, b, correct = 0, ghr = t->ghr, history_size = 11;
 	bool gshare_correct,    bimodal_correct,
 	     gshare_prediction, bimodal_prediction;
 
-	(void) memset(&gshare, STRONG_YES, 2048);
-	(void) memset(&bimodal, STRONG_YES, 2048);
-	(void) memset(&selector, PREFER_GSHARE, 2048);
-
-	for (int i = 0; i < g_traces_count; i++) {
+	for (unsigned i = begin; i < end; i++) {
 		struct pair branch = g_traces[i];
 		g = (branch.addr % 2048) ^ ghr;
 		b = (branch.addr % 2048);
@@ -200,24 +230,22 @@ sim_tournament(void *arg)
 		}
 	}
 	
-	p->correct = correct;
-	return NULL;
+	t->ghr = ghr;
+	p->correct += correct;
 }
 
-void *
-sim_btb(void *arg)
+void
+sim_btb(TParams *p, unsigned begin, unsigned end)
 {
-	TParams *p = arg;
 	/* Using singe bit bimodal with initial configuration 'Take' */
-	bool     hist[512];
-	uint64_t btb[512] = {0ULL};
+	struct tables *t = tables_of(p, true);
+	unsigned char *hist = t->pht;
+	uint64_t *btb = t->btb;
 	unsigned index, correct = 0, attempted = 0;
 
-	(void) memset(&hist, true, sizeof(hist));
-
-	for (int i = 0; i < g_traces_count; i++) {
+	for (unsigned i = begin; i < end; i++) {
 		struct pair branch = g_traces[i];
-		index = branch.addr % sizeof(hist);
+		index = branch.addr % 512;
 
 		if (hist[index]) {
 			attempted++;
@@ -232,22 +260,283 @@ sim_btb(void *arg)
 			btb[index] = branch.target;
 	}
 
-	p->attempted = attempted;
-	p->correct = correct;
+	p->attempted += attempted;
+	p->correct += correct;
+}
+
+static void
+sim_step(void *arg, unsigned begin, unsigned end)
+{
+	TParams *p = arg;
+
+	p->step(p, begin, end);
+}
+
+static void
+sim_reset(void *arg)
+{
+	TParams *p = arg;
+
+	p->correct = p->attempted = 0;
+}
+
+static unsigned
+sim_correct(void *arg)
+{
+	return ((TParams *) arg)->correct;
+}
+
+/* Branches are records and accesses alike */
+static uint64_t
+sim_branch_of(void *arg, unsigned record)
+{
+	(void) arg;
+	return record;
+}
+
+static unsigned
+sim_record_of(void *arg, uint64_t branch)
+{
+	(void) arg;
+	return branch < g_traces_count ? branch : g_traces_count;
+}
+
+/* Steps a predictor over branches [begin, end) (see steps_run), its series
+   holding correct predictions */
+static void
+sim_steps(TParams *p, unsigned begin, unsigned end)
+{
+	steps_run(&(Steps) {p, sim_step, sim_reset, sim_correct, sim_branch_of, sim_record_of,
+	                    g_warmup, g_warmup, g_interval, p->series, &p->seconds},
+	          begin, end);
+}
+
+/* Structured output of the predictors (see enum format) */
+typedef struct {
+	const char *predictor;
+	unsigned table_size, history_size;
+} Config;
+
+static Config
+predictor_config(const TParams *p)
+{
+	if (p->step == sim_always)
+		return (Config) {p->always_val ? "always_taken" : "never_taken", 0, 0};
+	if (p->step == sim_bimodal_one)
+		return (Config) {"bimodal_one_bit", p->table_size, 0};
+	if (p->step == sim_bimodal_two)
+		return (Config) {"bimodal_two_bit", p->table_size, 0};
+	if (p->step == sim_gshare)
+		return (Config) {"gshare", 2048, p->history_size};
+	if (p->step == sim_tournament)
+		return (Config) {"tournament", 2048, 11};
+
+	return (Config) {"btb", 512, 0};
+}
+
+/* Prints the record of a predictor that made predictions, with its series
+   in JSON */
+static void
+print_record(FILE *output, enum format format, const TParams *p, unsigned predictions,
+             unsigned intervals)
+{
+	const Config c = predictor_config(p);
+	const double rate = predictions ? (double) p->correct / predictions : 0;
+	const double speed = p->seconds > 0 ? (g_traces_count - g_warmup) / p->seconds : 0;
+
+	if (format == FORMAT_CSV) {
+		fprintf(output, "%s,%u,%u,%u,%u,%.6f,%.6f,%.0f\n", c.predictor, c.table_size,
+		        c.history_size, p->correct, predictions, rate, p->seconds, speed);
+		return;
+	}
+
+	fprintf(output, "{\"predictor\": \"%s\", \"table_size\": %u, \"history_size\": %u, "
+	        "\"correct\": %u, \"predictions\": %u, \"accuracy\": %.6f, \"seconds\": %.6f, "
+	        "\"branches_per_second\": %.0f", c.predictor, c.table_size, c.history_size,
+	        p->correct, predictions, rate, p->seconds, speed);
+	print_series_json(output, p->series, intervals);
+}
+
+/* Runs a predictor over the whole trace on its own */
+void *
+sim_run(void *arg)
+{
+	TParams *p = arg;
+
+	sim_steps(p, 0, g_traces_count);
+
 	return NULL;
 }
 
+/*
+ * Fused simulation of many predictors (see fused_run), in blocks of
+ * FUSED_BLOCK branches.
+ */
+#define FUSED_BLOCK 8192 /* Branches, 192KB of trace */
+
+static unsigned
+sim_fused_records(void *arg)
+{
+	(void) arg;
+	return g_traces_count;
+}
+
+static void
+sim_fused_step(void *arg, unsigned begin, unsigned end)
+{
+	sim_steps(arg, begin, end);
+}
+
+/* Checkpoints of the predictors (see Checkpoint): the part of their tables
+   they use, in the order of the report. The always predictors have none. */
+#define CHECKPOINT_MAGIC "PREDCKP3"
+#define CHECKPOINT_TABLES 5
+
+/* Sets the tables of the predictor to the parts of t it uses: the ghr, pht,
+   bimodal, selector and btb, each with its size in bytes, 0 if unused */
+static void
+tables_used(const TParams *p, struct tables *t, void *tables[], uint64_t sizes[])
+{
+	const bool tournament = p->step == sim_tournament;
+
+	tables[0] = &t->ghr;
+	tables[1] = t->pht;
+	tables[2] = t->bimodal;
+	tables[3] = t->selector;
+	tables[4] = t->btb;
+
+	sizes[0] = tournament || p->step == sim_gshare ? sizeof(t->ghr) : 0;
+	sizes[1] = p->step == sim_btb ? 512 : tournament || p->step == sim_gshare ? sizeof(t->pht) :
+	           (uint64_t) p->table_size;
+	sizes[2] = tournament ? sizeof(t->bimodal) : 0;
+	sizes[3] = tournament ? sizeof(t->selector) : 0;
+	sizes[4] = p->step == sim_btb ? sizeof(t->btb) : 0;
+}
+
+/* Writes or reads the tables of the predictors in p */
+void
+checkpoint(const char *path, bool write, TParams p[7][10])
+{
+	static const char *const names[] = {"predictors", "ghr bytes", "pht bytes",
+	                                    "bimodal bytes", "selector bytes", "btb bytes"};
+	uint64_t header[1 + CHECKPOINT_TABLES] = {0};
+	void *tables[CHECKPOINT_TABLES];
+	uint64_t sizes[CHECKPOINT_TABLES];
+	struct tables t;
+	Checkpoint c;
+
+	for (int x = 2; x < 7; x++)
+		for (int i = 0; i < 10; i++) {
+			if (!p[x][i].step)
+				continue;
+			header[0]++;
+			tables_used(&p[x][i], &t, tables, sizes);
+			for (int k = 0; k < CHECKPOINT_TABLES; k++)
+				header[1 + k] += sizes[k];
+		}
+
+	c = checkpoint_open(path, write, CHECKPOINT_MAGIC, header, names,
+	                    sizeof(header) / sizeof(header[0]), "does not hold these predictors");
+
+	for (int x = 2; x < 7; x++)
+		for (int i = 0; i < 10; i++) {
+			TParams *q = &p[x][i];
+
+			if (!q->step)
+				continue;
+			if (!q->tables)
+				q->step(q, 0, 0); /* Never stepped, with initial tables */
+
+			tables_used(q, q->tables, tables, sizes);
+			for (int k = 0; k < CHECKPOINT_TABLES; k++)
+				checkpoint_field(&c, tables[k], sizes[k]);
+		}
+
+	checkpoint_close(&c);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	        "Usage: predictors [-F GROUPS] [-L] [-x WARMUP] [-t N] [-f FORMAT]\n"
+	        "                  [-c FILE] [-e FILE] input_trace.txt output.txt\n"
+	        "  -F GROUPS  fuse the predictors into GROUPS jobs, each\n"
+	        "             reading the trace once for all its predictors\n"
+	        "  -L         keep the fused jobs in lockstep over the trace,\n"
+	        "             fusing into a job per CPU without -F\n"
+	        "  -x WARMUP  train on the first WARMUP branches, or WARMUP%%\n"
+	        "             of them, without counting them\n"
+	        "  -t N       also write the correct predictions of every\n"
+	        "             predictor in each N branches after the warm-up,\n"
+	        "             not with -f csv\n"
+	        "  -f FORMAT  legacy, or json or csv with a record per\n"
+	        "             predictor (default legacy)\n"
+	        "  -c FILE    write the tables of the predictors to FILE\n"
+	        "             at the end of the run\n"
+	        "  -e FILE    start from the tables in FILE, written by -c\n");
+	exit(1);
+}
+
 int
 main(int argc, char *argv[])
 {
-	if (argc != 3)
-		fprintf(stderr, "Usage: predictors input_trace.txt output.txt\n"), exit(1);
+	unsigned fused = 0;
+	bool lockstep = false;
+	const char *warmup = NULL, *save = NULL, *resume = NULL;
+	enum format format = FORMAT_LEGACY;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "F:Lx:t:f:c:e:")) != -1) {
+		switch (opt) {
+		case 'F':
+			if (atoi(optarg) < 1)
+				fprintf(stderr, "Invalid group count %s for -F.\n", optarg), usage();
+			fused = atoi(optarg);
+			break;
+		case 'L':
+			lockstep = true;
+			break;
+		case 'x':
+			if (!warmup_valid(warmup = optarg))
+				fprintf(stderr, "Invalid warm-up %s for -x.\n", optarg), usage();
+			break;
+		case 't':
+			if (atoi(optarg) < 1)
+				fprintf(stderr, "Invalid interval %s for -t.\n", optarg), usage();
+			g_interval = atoi(optarg);
+			break;
+		case 'f':
+			if (!strcmp(optarg, "json"))
+				format = FORMAT_JSON;
+			else if (!strcmp(optarg, "csv"))
+				format = FORMAT_CSV;
+			else if (strcmp(optarg, "legacy"))
+				fprintf(stderr, "Invalid format %s for -f.\n", optarg), usage();
+			break;
+		case 'c':
+			save = optarg;
+			break;
+		case 'e':
+			resume = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	/* CSV has no column for the series */
+	if (g_interval && format == FORMAT_CSV)
+		fprintf(stderr, "-t does not go with -f csv.\n"), usage();
+
+	if (argc - optind != 2)
+		usage();
 
 	unsigned long long addr, target;
 	char behavior[10];
 
-	FILE *input  = fopen(argv[1], "r"),
-	     *output = fopen(argv[2], "w");
+	FILE *input  = fopen(argv[optind], "r"),
+	     *output = fopen(argv[optind + 1], "w");
 
 	if (!input || !output)
 		fprintf(stderr, "Failed to open files.\n"), exit(1);
@@ -258,75 +547,127 @@ main(int argc, char *argv[])
 	while(fscanf(input, "%llx %10s %llx\n", &addr, behavior, &target) != EOF)
 		g_traces[g_traces_count++] = (struct pair) {addr, target, (bool) !strncmp(behavior, "T", 2)};
 
-	/* Arbitrarily picked 10 to prevent overflows... */
-	pthread_t  t[7][10] = {0};
+	if (warmup)
+		g_warmup = warmup_of(warmup, g_traces_count);
+	const unsigned counted = g_traces_count - g_warmup;
+	const unsigned intervals = g_interval ? (counted + g_interval - 1) / g_interval : 0;
+
+	/* Arbitrarily picked 10 to prevent overflows...
+	   Job costs are rough relative run times, for longest-job-first. */
 	TParams    p[7][10] = {0};
+	Job        jobs[7 * 10];
+	Fused      groups[7 * 10];
+	unsigned   progress[7 * 10] = {0}, amt = 0;
+	Lockstep   pace = {0, progress};
 
 	for (int x = 0; x < 10; x++) {
 		switch (x) {
 		case 0: /* FALLTHROUGH */
 		case 1:
-			p[x][0] = (TParams) {.correct = 0, .always_val = !x};
-			pthread_create(&t[x][0], NULL, &sim_always, (void *) &p[x][0]);
+			p[x][0] = (TParams) {.correct = 0, .always_val = !x, .step = &sim_always};
+			jobs[amt++] = (Job) {&sim_run, &p[x][0], 1};
 			break;
 		case 2: /* FALLTHROUGH */
 		case 3:
 			for (int table_size = 16, i = 0; table_size <= 2048; table_size *= 2, i++) {
 				if (table_size != 64) {
-					p[x][i] = (TParams) {.correct = 0, .table_size = table_size};
-					pthread_create(&t[x][i], NULL, x == 2 ? &sim_bimodal_one : &sim_bimodal_two, (void *) &p[x][i]); 
+					p[x][i] = (TParams) {.correct = 0, .table_size = table_size,
+					                     .step = x == 2 ? &sim_bimodal_one : &sim_bimodal_two};
+					jobs[amt++] = (Job) {&sim_run, &p[x][i], x};
 				}
 			}
 			break;
 		case 4:
 			for (int ghr_size = 3, i = 0; ghr_size <= 11; ghr_size++, i++) {
-				p[4][i] = (TParams) {.correct = 0, .history_size = ghr_size};
-				pthread_create(&t[4][i], NULL, &sim_gshare, (void *) &p[4][i]);
+				p[4][i] = (TParams) {.correct = 0, .history_size = ghr_size, .step = &sim_gshare};
+				jobs[amt++] = (Job) {&sim_run, &p[4][i], 3};
 			}
 			break;
 		case 5: /* FALLTHROUGH */
 		case 6:
-			p[x][0] = (TParams) {.correct = 0, .attempted = 0};
-			pthread_create(&t[x][0], NULL, x == 5 ? &sim_tournament : &sim_btb, (void *) &p[x][0]);
+			p[x][0] = (TParams) {.correct = 0, .attempted = 0,
+			                     .step = x == 5 ? &sim_tournament : &sim_btb};
+			jobs[amt++] = (Job) {&sim_run, &p[x][0], x == 5 ? 8 : 4};
 			break;
 		default: /* DO NOTHING CASE */
 			break;
 		}
 	}
 
-	/****** JOIN THREADS ******/
-	pthread_join(t[0][0], NULL);
-	fprintf(output, "%d,%d;\n", p[0][0].correct, g_traces_count);
+	for (unsigned j = 0; intervals && j < amt; j++)
+		if (!(((TParams *) jobs[j].arg)->series = calloc(intervals, sizeof(unsigned))))
+			fprintf(stderr, "Out of memory.\n"), exit(1);
+
+	if (resume)
+		checkpoint(resume, false, p);
+
+	/* -L alone fuses too, a group per CPU (see fuse_jobs) */
+	if (fused || lockstep)
+		amt = fuse_jobs(jobs, amt, fused ? fused : pool_cpus(), groups,
+		                (Fused) {.records = sim_fused_records, .step = sim_fused_step,
+		                         .block = FUSED_BLOCK, .lockstep = lockstep ? &pace : NULL});
+
+	pool_run(jobs, amt);
+
+	for (unsigned g = 0; (fused || lockstep) && g < amt; g++)
+		free(groups[g].configs);
+
+	if (save)
+		checkpoint(save, true, p);
+	for (int x = 0; x < 7; x++)
+		for (int i = 0; i < 10; i++)
+			free(p[x][i].tables);
+
+	if (format != FORMAT_LEGACY) {
+		if (format == FORMAT_CSV)
+			fprintf(output, "predictor,table_size,history_size,correct,predictions,"
+			        "accuracy,seconds,branches_per_second\n");
+		for (int x = 0; x < 7; x++)
+			for (int i = 0; i < 10; i++)
+				if (p[x][i].step) {
+					print_record(output, format, &p[x][i],
+					             x == 6 ? p[x][i].attempted : counted, intervals);
+					free(p[x][i].series);
+				}
 
-	pthread_join(t[1][0], NULL);
-	fprintf(output, "%d,%d;\n", p[1][0].correct, g_traces_count);
+		free(g_traces);
+		fclose(input);
+		fclose(output);
+		return 0;
+	}
+
+	/****** REPORT IN ORDER ******/
+	fprintf(output, "%d,%d;\n", p[0][0].correct, counted);
+
+	fprintf(output, "%d,%d;\n", p[1][0].correct, counted);
 	
 	for (int table_size = 16, i = 0; table_size <= 2048; table_size *= 2, i++) {
 		if (table_size != 64) {
-			pthread_join(t[2][i], NULL);
-			fprintf(output, "%d,%d; ", p[2][i].correct, g_traces_count);
+			fprintf(output, "%d,%d; ", p[2][i].correct, counted);
 		}
 	}
 	fprintf(output, "\n");
 	
 	for (int table_size = 16, i = 0; table_size <= 2048; table_size *= 2, i++) {
 		if (table_size != 64) {
-			pthread_join(t[3][i], NULL);
-			fprintf(output, "%d,%d; ", p[3][i].correct, g_traces_count);
+			fprintf(output, "%d,%d; ", p[3][i].correct, counted);
 		}
 	}
 	fprintf(output, "\n");
 
 	for (int ghr_size = 3, i = 0; ghr_size <= 11; ghr_size++, i++) {
-		pthread_join(t[4][i], NULL);
-		fprintf(output, "%d,%d; ", p[4][i].correct, g_traces_count);
+		fprintf(output, "%d,%d; ", p[4][i].correct, counted);
 	}
 
-	pthread_join(t[5][0], NULL);
-	fprintf(output, "\n%d,%d;", p[5][0].correct, g_traces_count);
+	fprintf(output, "\n%d,%d;", p[5][0].correct, counted);
 
-	pthread_join(t[6][0], NULL);
 	fprintf(output, "\n%d,%d;\n", p[6][0].correct, p[6][0].attempted);
+
+	/* The series, a line per predictor in the order above */
+	for (int x = 0; intervals && x < 7; x++)
+		for (int i = 0; i < 10; i++)
+			if (p[x][i].series)
+				print_series(output, &p[x][i].series, intervals);
 	
 	free(g_traces);
 	fclose(input);